@@ -3,6 +3,7 @@ Find GC content and length of a DNA sequence in a FASTA file
 
 Input:
 A file with a single DNA sequence in FASTA format (https://en.wikipedia.org/wiki/FASTA_format)
+Optionally, the name of one sequence in a larger FASTA file, or a region of it (name:start-end)
 
 Output:
 Length of the sequence (number of nucleotides)
@@ -11,7 +12,7 @@ GC content (% G-C base pairs)
 
 Learning objective: 
 1. reading data from a file
-2. basic understanding of the ifstream class and some of its most useful member functions
+2. using a class from a shared header file (FastaReader) and its member functions
 3. caveats of integer division
 
 Code written by Jan Mrazek, mrazek@uga.edu
@@ -21,67 +22,80 @@ Code written by Jan Mrazek, mrazek@uga.edu
 
 
 #include <iostream>
-#include <fstream>  // container that includes the class ifstream
 #include <string>  // container that includes the class string
 
+#include "../common/fasta_reader.h"  // the FASTA reader shared by all programs in this repository (class FastaReader)
+#include "../common/fasta_index.h"   // reading one sequence of a FASTA file by its name (class IndexedFasta)
+
 using namespace std;
 
 int main(int argc, char **argv) {
 
 	if (argc<2)  {
-		cout << "Use as:  " << argv[0] << " <FASTA_file_name>\n";
-		cout << "!!! The file can contain only one sequence\n";
+		cout << "Use as:  " << argv[0] << " <FASTA_file_name> [<sequence_name> or <name>:<start>-<end>]\n";
+		cout << "!!! Without a sequence name the file can contain only one sequence\n";
 		cout << "Example: " << argv[0] << " Ecoli.fasta\n";
+		cout << "Example: " << argv[0] << " genome.fasta chr2:10001-20000\n";
 		return 0;
 	}
 	
-	ifstream InFile(argv[1]);
-// This creates input stream InFile and associates it with file argv[1] (the first command line argument).
-// It opens the file for access.
-// In object oriented terms: this statement constructs an object InFile of the class ifstream, associated with the file argv[1].
-// You can find a complete reference to ifstream class and all its functions here https://cplusplus.com/reference/fstream/ifstream/
-// but do not worry if you cannot decipher what the website says. It is not that complex once you get the hang of it, but it is running
-// way ahead of where we are now.
-
-// The first thing to do is check if the file was opened successfully
-// For example, the command would fail if the user mistyped the file name
-	if (!InFile.is_open())  {
+	FastaReader Reader;
+// This creates an object Reader of the class FastaReader, which is defined in ../common/fasta_reader.h. That file is
+// shared by all the programs in this repository, so FASTA files are read the same way everywhere (the quoted name in
+// the #include line tells the compiler to look for it relative to this file rather than among the system headers).
+	IndexedFasta Indexed;
+	FastaRecord Record;
+// Indexed is used instead of Reader when the user names a sequence (see below). Record will hold the sequence we count.
+
+	if (argc>2)  {
+// If the user names a sequence (or a region of one), the program does not read the file from the beginning. Instead,
+// it finds the sequence through an index: a small file (the FASTA file name with .fai added) that lists where each
+// sequence starts in the file and how long its lines are, so the computer can jump straight to the right bytes.
+// The index is made the first time it is needed and reused afterwards. This is how you can count a piece of one
+// chromosome in a genome of several GB in a fraction of a second.
+		string Error;
+		if (!Indexed.open(argv[1], Error) || !Indexed.fetch(argv[2], Record, Error))  {
+			cout << Error << "\n";
+			return 1;
+		}
+	}
+	else  {
+		if (!Reader.open(argv[1]))  {
 // ! is a negation, so this condition is true if the file failed to open
-// InFile.is_open() tells the computer to apply the member function is_open() (member of the class ifstream) to the object InFile.
-// The parentheses specify that is_open is a function but are empty because we are not passing any arguments to the funciton
-// The is_open function returns true if the stream is open and false if not. See https://cplusplus.com/reference/fstream/ifstream/is_open/
-		cout << "Cannot open file \"" << argv[1] << "\"\n";
+// Reader.open(argv[1]) tells the computer to apply the member function open() (member of the class FastaReader) to the object
+// Reader, with the file name argv[1] (the first command line argument) as the argument.
+// The open function returns true if the file could be opened and false if not. For example, it would fail if the user mistyped the file name.
+			cout << "Cannot open file \"" << argv[1] << "\"\n";
 // If you want to use " in a string literal, you have to type \" because " alone has a special meaning
-		return 1;
+			return 1;
 // If the file failed to open, I print a message and quit
-	}
-	
+		}
+		
 // Now we know that the file is open and we can start reading from it.
 
-	char Z;
-	InFile.get(Z);
-// get() is another member function of the class ifstream. It reads a single character from the stream
-// I stored the character as Z.
-
+		if (!Reader.next(Record) || Record.header.empty())  {
+// next() is another member function of the class FastaReader. It reads one whole record (a header line and the sequence
+// that follows it) and stores it in Record. It returns false if there is nothing more to read.
 // I like to include simple checks whether the input is what I expect it to be when possible. For example, a FASTA file should 
-// start with >, which should now be in the variable Z. So let's check if it's true:
-	if (Z!='>')  {
-// '>' is a character constant. The difference between ">" and '>' is that ">" is a string that contains a single character '>'
-		cout << "The file does not appear to be in FASTA format\n";
-		return 1;
+// start with a header line starting with >. If it does not, the reader returns the text before the first > with an empty header.
+// Record.header.empty() is true if the header has no characters, so the condition is true for an empty file and for a file
+// that does not start with a header.
+			cout << "The file does not appear to be in FASTA format\n";
+			return 1;
+		}
+// if the file does not start with a header I print a message and quit.
 	}
-// if the first character in the file is not > I print a message and quit.
 
-// The first line (starting with >) is the sequence header, which we want to ignore (the sequence starts on the next line)
-// Without knowing any other functions than get(), we can simply read characters until we find the end of the line, denoted by \n:
-	while (Z!='\n')  InFile.get(Z);
-	
-// Now we are at the start of the second line in the file, so the next character we read should be the first nucleotide of the DNA sequence
-// But we do not want to read just one nucleotide -- we want to read the whole sequence and count the number of 
+// Record.header now holds the header line (which we want to ignore) and Record.sequence the whole sequence, with the
+// ends of lines (\n) already removed. Neither is a copy of the text: they are views (of the class string_view) that point
+// to the characters where the reader keeps them, so even a large genome is not copied.
+// We do not want just one nucleotide -- we want to go through the whole sequence and count the number of 
 // nucleotides and GC and AT base pairs. Let's prepare for the counting and set the counters to 0:
-	int AT=0;
-	int GC=0;
-	int Length=0;
+	long long AT=0;
+	long long GC=0;
+	long long Length=0;
+// The counters are of the type long long, integers of 64 bits. An int has only 32 bits and cannot count past 2,147,483,647,
+// fewer nucleotides than some chromosomes and many genome assemblies have.
 
 
 	string OtherCodes="RYMKBDHVNrymkbdhvn";
@@ -89,10 +103,9 @@ int main(int argc, char **argv) {
 // If you are not familiar with the IUPAC code, see, for example https://www.bioinformatics.org/sms/iupac.html
 // Don't think about it too much now -- it will come into play a few lines below.
 
-	while (InFile.get(Z))  {
-// This is the easiest way to read characters until the end of the file. InFile.get(Z) reads the next character and stores it 
-// in Z, and checks if the operation was successful. If it was unsuccessful (e.g., because there are no more characters in the file),
-// the condition is false, and the loop will end.
+	for (char Z : Record.sequence)  {
+// This is the easiest way to go through all characters of the sequence. The loop runs once for every character in
+// Record.sequence, from the first to the last, and each time Z holds the current character.
 
 // Now one needs to think about different characters that can be in the file and their meaning:
 // CGcgSs -- should count towards G+C
@@ -124,10 +137,15 @@ int main(int argc, char **argv) {
 		}
 	}
 	
-// Now I finished reading the file and counted the G-C base pairs, A-T base pairs, and all characters that signify
-// nucleotides, while all other characters (e.g., the new line characters, '\n' were ignored.
-// I won't need the file anymore, so I can close it:
-	InFile.close();
+// Now I finished going through the sequence and counted the G-C base pairs, A-T base pairs, and all characters that signify
+// nucleotides, while all other characters (e.g., -, which marks a gap in aligned sequences) were ignored.
+
+// The program counts only one sequence. If there is another record in the file, I print a warning so that the user knows
+// it was not counted (when a sequence was named, Reader was never opened, so Reader.next() just returns false):
+	if (Reader.next(Record))  cout << "!!! The file contains more than one sequence; only the first one was counted\n";
+	if (Reader.failed())  return 1;
+// A gzip file that is damaged or cut short makes the reader stop early, as if the file ended there. The reader prints
+// a message about it; failed() tells us, so that we do not print the GC content of a sequence that may be incomplete.
 	
 // I can print the results now. For length, it's easy:
 	cout << "Sequence length: " << Length << " nucleotides\n";
@@ -139,8 +157,8 @@ int main(int argc, char **argv) {
 // decimal part will convert the result to 0. To avoid that, I have to cast (change the variable type) at least one
 // of the operands as double (or float). This can be done by a function double that converts teh argument to type double:
 	cout << "GC content: " << double(GC)/(GC+AT)*100.0 << "%\n";
-// In the expression above, GC is of the type int whereas double(GC) is of the type double.
-// Dividing double by int yields a double due to implicit conversion of (GC+AT) in the expression,
+// In the expression above, GC is of the type long long whereas double(GC) is of the type double.
+// Dividing double by an integer yields a double due to implicit conversion of (GC+AT) in the expression,
 // so I do not need to (but can) write double(GC)/double(GC+AT)*100.0.
 
 // Alternatively, I could use this (I commented it out but you can remove the // to see that it works):
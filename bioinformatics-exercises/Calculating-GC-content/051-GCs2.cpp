@@ -5,15 +5,20 @@ Using a different way to count the nucleotides to avoid the complex if statement
 
 Input:
 A file with a single DNA sequence in FASTA format (https://en.wikipedia.org/wiki/FASTA_format)
+Optionally, the name of one sequence in a larger FASTA file, or a region of it (name:start-end)
+Optionally, --window <size> [--step <size>] [--track gc|skew|cumskew] to scan every sequence (or the region) in windows
 
 Output:
 Length of the sequence (number of nucleotides)
 GC content (% G-C base pairs) 
+With --window, a bedGraph track (https://genome.ucsc.edu/goldenPath/help/bedgraph.html) with the GC content, the GC skew
+(G-C)/(G+C) or the cumulative GC skew of each window
 
 
 Learning objetive: 
 1. ASCII code
 2. Practice using arrays
+3. Sliding windows with running totals
 
 Code written by Jan Mrazek, mrazek@uga.edu
 
@@ -22,62 +27,377 @@ Code written by Jan Mrazek, mrazek@uga.edu
 
 
 #include <iostream>
-#include <fstream>  // container that includes the class ifstream
-#include <string>  // container that includes the class string
+#include <string>     // container that includes the class string
+#include <string_view>
+#include <vector>
+#include <deque>      // a queue that can grow at the back and shrink at the front
+#include <cstring>    // memchr
+#include <cctype>
+#include <algorithm>  // min
+#include <charconv>   // to_chars
+
+#include "../common/fasta_reader.h"  // the FASTA reader shared by all programs in this repository (class FastaReader)
+#include "../common/fasta_index.h"   // reading one sequence of a FASTA file by its name (class IndexedFasta)
+#include "../common/gzip_input.h"    // reading plain and gzip-compressed files alike (class InputFile)
 
 using namespace std;
 
+// With --window, every character is sorted into one of these classes. S (G or C) counts as GC but not in the skew,
+// and NOT_BASE marks the ends of lines and spaces, which are not positions in the sequence.
+enum  { BASE_G, BASE_C, BASE_S, BASE_AT, BASE_OTHER, NOT_BASE, CLASS_COUNT };
+
+// The value written for each window
+enum Track  { TRACK_GC, TRACK_SKEW, TRACK_CUMULATIVE_SKEW };
+
+// The class of every character, indexed by its code as an unsigned char (0-255)
+unsigned char WindowClass[256];
+
+// Running totals of the classes from the start of a sequence up to Position
+struct WindowMark  {
+	long long Position;
+	long long Counts[CLASS_COUNT];
+};
+
+// The state of the window scan of one sequence.
+// Counting each window from scratch would add up Size nucleotides per window, which is slow when the windows overlap.
+// Instead, the program keeps running totals from the start of the sequence (Total) and remembers them where each
+// window starts (Starts). The counts in a window are then the totals at its end minus the totals at its start, so each
+// nucleotide is counted only once whatever the window and step, and only the marks of the windows that have started
+// but not ended are kept, never the sequence itself.
+struct WindowScan  {
+	long long Size;
+	long long Step;
+	Track Value;
+	string Name;                // the name of the sequence in the bedGraph
+	long long Offset;           // the position of the first nucleotide (not 0 for a region)
+	WindowMark Total;
+	deque<WindowMark> Starts;   // the totals at the start of each window that has not ended yet
+	long long NextStart;        // where the next window starts
+	long long NextEnd;          // where the oldest window in Starts ends
+	long long LastEnd;          // where the last printed window ended
+	double CumulativeSkew;
+	bool Open;                  // a sequence is being scanned
+	bool Started;               // the track line has been printed
+};
+
+// Fill in WindowClass
+void setupWindowClasses()  {
+	for (int i=0;i<256;++i)  WindowClass[i]=BASE_OTHER;
+	WindowClass['G']=WindowClass['g']=BASE_G;
+	WindowClass['C']=WindowClass['c']=BASE_C;
+	WindowClass['S']=WindowClass['s']=BASE_S;
+	for (char Z : string("ATUWatuw"))  WindowClass[(unsigned char)Z]=BASE_AT;
+	for (char Z : string("\n\r\t "))  WindowClass[(unsigned char)Z]=NOT_BASE;
+}
+
+// The name of a sequence: its header line up to the first space, without the >
+string sequenceName(string_view Header)  {
+	size_t End=0;
+	while (End<Header.size() && !isspace((unsigned char)Header[End]))  ++End;
+	return string(Header.substr(0,End));
+}
+
+// Start scanning a sequence
+void startWindows(WindowScan& Scan, const string& Name, long long Offset)  {
+	if (!Scan.Started)  {
+		const char* TrackNames[]={"GC content (%)", "GC skew", "Cumulative GC skew"};
+		cout << "track type=bedGraph name=\"" << TrackNames[Scan.Value] << "\"\n";
+		Scan.Started=true;
+	}
+	Scan.Name=Name;
+	Scan.Offset=Offset;
+	Scan.Total=WindowMark{};
+	Scan.Starts.assign(1, Scan.Total);
+	Scan.NextStart=Scan.Step;
+	Scan.NextEnd=Scan.Size;
+	Scan.LastEnd=0;
+	Scan.CumulativeSkew=0.0;
+	Scan.Open=true;
+}
+
+// Print the window from Start to the current position as a bedGraph line: name, start, end and value, with positions
+// counted from 0 and the end excluded. A window of only N has no GC content and is left out.
+void printWindow(WindowScan& Scan, const WindowMark& Start)  {
+	const long long* Totals=Scan.Total.Counts;
+	long long G=Totals[BASE_G]-Start.Counts[BASE_G];
+	long long C=Totals[BASE_C]-Start.Counts[BASE_C];
+	long long GC=G+C+Totals[BASE_S]-Start.Counts[BASE_S];
+	long long AT=Totals[BASE_AT]-Start.Counts[BASE_AT];
+	Scan.LastEnd=Scan.Total.Position;
+	if (GC+AT==0)  return;
+
+	double Skew=(G+C>0) ? double(G-C)/(G+C) : 0.0;
+	Scan.CumulativeSkew+=Skew;
+// The cumulative skew is the sum of the skews of the windows so far. In bacteria it falls to its minimum at the origin
+// of replication and rises to its maximum at the terminus.
+	double Value=Skew;
+	if (Scan.Value==TRACK_GC)  Value=100.0*GC/(GC+AT);
+	else if (Scan.Value==TRACK_CUMULATIVE_SKEW)  Value=Scan.CumulativeSkew;
+// There can be millions of windows, so the numbers are written with to_chars, which is much faster than <<, into an
+// array of characters that is then printed at once. The value gets 4 decimal places. Each to_chars is given one character
+// less than the rest of Line, so the tab or end of line after the number always fits.
+	char Line[80];
+	char* End=Line;
+	*End++='\t';
+	End=to_chars(End, Line+sizeof(Line)-1, Scan.Offset+Start.Position).ptr;
+	*End++='\t';
+	End=to_chars(End, Line+sizeof(Line)-1, Scan.Offset+Scan.Total.Position).ptr;
+	*End++='\t';
+	End=to_chars(End, Line+sizeof(Line)-1, Value, chars_format::fixed, 4).ptr;
+	*End++='\n';
+	cout << Scan.Name;
+	cout.write(Line, End-Line);
+}
+
+// Called when the scan reaches the end of a window or the start of the next one
+void passWindowMark(WindowScan& Scan)  {
+	if (Scan.Total.Position==Scan.NextEnd)  {
+		printWindow(Scan, Scan.Starts.front());
+		Scan.Starts.pop_front();
+		Scan.NextEnd+=Scan.Step;
+	}
+	if (Scan.Total.Position==Scan.NextStart)  {
+		Scan.Starts.push_back(Scan.Total);
+		Scan.NextStart+=Scan.Step;
+	}
+}
+
+// Add a piece of the sequence, ends of lines included
+void addWindowBases(WindowScan& Scan, const char* Text, size_t Length)  {
+	long long* Counts=Scan.Total.Counts;
+	while (Length>0)  {
+// The next ToMark characters cannot take the scan past the next mark (the start or end of a window), even if they are
+// all nucleotides, so they are simply counted. This loop is where almost all the time is spent.
+		size_t ToMark=min(Scan.NextStart, Scan.NextEnd)-Scan.Total.Position;
+		if (ToMark>Length)  ToMark=Length;
+		long long Skipped=Counts[NOT_BASE];
+		for (size_t i=0;i<ToMark;++i)  ++Counts[WindowClass[(unsigned char)Text[i]]];
+		Scan.Total.Position+=ToMark-(Counts[NOT_BASE]-Skipped);
+		Text+=ToMark;
+		Length-=ToMark;
+// If there were ends of lines among them, the mark is not reached yet and the loop counts the few missing characters
+		if (Scan.Total.Position==Scan.NextStart || Scan.Total.Position==Scan.NextEnd)  passWindowMark(Scan);
+	}
+}
+
+// Finish a sequence. If its end is not covered by a whole window, the last window is printed shorter, ending with the
+// sequence; a sequence shorter than one window gets one window.
+void endWindows(WindowScan& Scan)  {
+	if (!Scan.Open)  return;
+	if (!Scan.Starts.empty() && Scan.Starts.front().Position<Scan.Total.Position && Scan.LastEnd<Scan.Total.Position)
+		printWindow(Scan, Scan.Starts.front());
+	Scan.Open=false;
+}
+
+// Scan every sequence of a FASTA file in windows. The file is read in blocks of 1 MB, so a whole genome is never held
+// in memory, and gzip files are decompressed on the way. Returns false if the file does not look like FASTA or is a
+// damaged gzip file (File.failed() tells which).
+bool scanFastaWindows(InputFile& File, WindowScan& Scan)  {
+	vector<char> Block(1<<20);
+	string Header;
+	bool InHeader=false;
+	bool LineStart=true;  // the last block ended with the end of a line
+	bool Found=false;
+	while (true)  {
+		File.read(Block.data(), Block.size());
+		size_t Size=File.gcount();
+		if (Size==0)  break;
+// File.gcount() is the number of characters the last read got, fewer than asked for at the end of the file
+		const char* Text=Block.data();
+		size_t Position=0;
+		while (Position<Size)  {
+			if (InHeader)  {
+				const char* End=(const char*)memchr(Text+Position, '\n', Size-Position);
+				size_t Stop=(End!=NULL) ? End-Text : Size;
+				Header.append(Text+Position, Stop-Position);
+				Position=Stop;
+				if (End!=NULL)  {
+					startWindows(Scan, sequenceName(Header), 0);
+					InHeader=false;
+					++Position;
+				}
+				continue;
+			}
+// Look for the next header: a > at the start of a line. Everything before it belongs to the current sequence.
+			size_t Next=Position;
+			while (true)  {
+				const char* Marker=(const char*)memchr(Text+Next, '>', Size-Next);
+				if (Marker==NULL)  {
+					Next=Size;
+					break;
+				}
+				Next=Marker-Text;
+				if (Next==0 ? LineStart : Text[Next-1]=='\n')  break;
+				++Next;
+			}
+			if (Scan.Open)  addWindowBases(Scan, Text+Position, Next-Position);
+			else  {
+				for (size_t i=Position;i<Next;++i)  if (WindowClass[(unsigned char)Text[i]]!=NOT_BASE)  return false;
+			}
+			if (Next<Size)  {
+				endWindows(Scan);
+				Header.clear();
+				InHeader=true;
+				Found=true;
+				++Next;
+			}
+			Position=Next;
+		}
+		LineStart=(Text[Size-1]=='\n');
+	}
+	if (File.failed())  return false;
+// A damaged gzip file ends early; the window it ends in is not printed
+	if (InHeader)  startWindows(Scan, sequenceName(Header), 0);
+	endWindows(Scan);
+	return Found;
+}
+
 int main(int argc, char **argv) {
 
 	if (argc<2)  {
-		cout << "Use as:  " << argv[0] << " <FASTA_file_name>\n";
-		cout << "!!! The file can contain only one sequence\n";
+		cout << "Use as:  " << argv[0] << " <FASTA_file_name> [<sequence_name> or <name>:<start>-<end>]"
+		     << " [--window <size> [--step <size>] [--track gc|skew|cumskew]]\n";
+		cout << "!!! Without a sequence name or --window the file can contain only one sequence\n";
 		cout << "Example: " << argv[0] << " Ecoli.fasta\n";
+		cout << "Example: " << argv[0] << " genome.fasta chr2:10001-20000\n";
+		cout << "Example: " << argv[0] << " Ecoli.fasta --window 5000 --step 1000 --track cumskew > skew.bedGraph\n";
 		return 0;
 	}
 	
-	ifstream InFile(argv[1]);
-	if (!InFile.is_open())  {
-		cout << "Cannot open file \"" << argv[1] << "\"\n";
+	string RegionText;
+	WindowScan Scan={};
+	Scan.Value=TRACK_GC;
+	bool TrackChosen=false;
+	for (int i=2;i<argc;++i)  {
+		string Argument=argv[i];
+		if ((Argument=="--window" || Argument=="--step") && i+1<argc)  {
+			long long Value;
+			try  {
+				Value=stoll(argv[++i]);
+			}
+			catch (...)  {
+				Value=0;
+			}
+// stoll converts text to a long long; if the text is not a number it throws an exception, which catch (...) catches
+			if (Value<=0)  {
+				cout << Argument << " must be a positive integer\n";
+				return 1;
+			}
+			if (Argument=="--window")  Scan.Size=Value;
+			else  Scan.Step=Value;
+		}
+		else if (Argument=="--track" && i+1<argc)  {
+			string Name=argv[++i];
+			if (Name=="gc")  Scan.Value=TRACK_GC;
+			else if (Name=="skew")  Scan.Value=TRACK_SKEW;
+			else if (Name=="cumskew")  Scan.Value=TRACK_CUMULATIVE_SKEW;
+			else  {
+				cout << "Unknown track \"" << Name << "\" (use gc, skew or cumskew)\n";
+				return 1;
+			}
+			TrackChosen=true;
+		}
+		else if (RegionText.empty() && Argument.compare(0,2,"--")!=0)  RegionText=Argument;
+		else  {
+			cout << "Unknown option \"" << Argument << "\"\n";
+			return 1;
+		}
+	}
+	if (Scan.Size==0 && (Scan.Step>0 || TrackChosen))  {
+		cout << "--step and --track need --window\n";
 		return 1;
 	}
+	if (Scan.Step==0)  Scan.Step=Scan.Size;
+// Without --step the windows follow each other without overlapping
+
+	if (Scan.Size>0)  {
+		setupWindowClasses();
+		if (!RegionText.empty())  {
+// The region is read through the index with joinLines false, so its lines are not copied: addWindowBases skips the
+// ends of lines itself
+			IndexedFasta Indexed(false);
+			FastaRegion Region;
+			string Error;
+			if (!Indexed.open(argv[1], Error) || !parseRegion(Indexed.index(), RegionText, Region, Error))  {
+				cout << Error << "\n";
+				return 1;
+			}
+			FastaRecord Record;
+			Indexed.fetch(Region, Record);
+			startWindows(Scan, Region.entry->name, Region.start);
+			addWindowBases(Scan, Record.lines.data(), Record.lines.size());
+			endWindows(Scan);
+			return 0;
+		}
+		InputFile File;
+		if (!File.open(argv[1]))  {
+			cout << "Cannot open file \"" << argv[1] << "\"\n";
+			return 1;
+		}
+		if (!scanFastaWindows(File, Scan))  {
+			if (!File.failed())  cout << "The file does not appear to be in FASTA format\n";
+			return 1;
+		}
+		return 0;
+	}
 	
-	char Z=InFile.get();
-	if (Z!='>')  {
-		cout << "The file does not appear to be in FASTA format\n";
-		return 1;
+	FastaReader Reader;
+	IndexedFasta Indexed;
+	FastaRecord Record;
+	if (!RegionText.empty())  {
+		string Error;
+		if (!Indexed.open(argv[1], Error) || !Indexed.fetch(RegionText, Record, Error))  {
+			cout << Error << "\n";
+			return 1;
+		}
+	}
+	else  {
+		if (!Reader.open(argv[1]))  {
+			cout << "Cannot open file \"" << argv[1] << "\"\n";
+			return 1;
+		}
+		
+		if (!Reader.next(Record) || Record.header.empty())  {
+			cout << "The file does not appear to be in FASTA format\n";
+			return 1;
+		}
 	}
-	while (Z!='\n')  Z=InFile.get();
 	
 
 // Up to here, everything is the same as in the previous version of the code
 // What I am planning to do next is count all possible different characters, how many times
-// each appears in the file (after skipping the first line. For that, I am going to reference
+// each appears in the sequence (the header line is kept separately). For that, I am going to reference
 // the ASCII table: https://www.asciitable.com/
 // There are 128 standard characters, each represented by a numerical code between 0 and 127.
 // A variable of type char stores a number that represents the character.
 // For example, a statement char A='C' is the same as char A=67 because 67 is ASCII code for C.
-// I am going to take advantage of that and set an array with 128 elements of type int:
-	int Counts[128]={};
+// I am going to take advantage of that and set an array of type long long
+// (64-bit integers; an int has 32 bits and could not count past 2,147,483,647 nucleotides).
+// A file can also hold characters with codes 128-255 (accented letters, or a damaged file). A char holds them as
+// negative numbers, which would point before the start of the array, so I read each character as an unsigned char
+// (codes 0-255) and give the array 256 elements:
+	long long Counts[256]={};
 // The ={} is a simple way to initialize all values of the array to 0. I could also run a for loop
 // to assign 0 to each element of the array.
 
-	while (InFile.get(Z))  {
+	for (unsigned char Z : Record.sequence)  {
 		++Counts[Z];
 // Now instead of all the ifs, I simply increment the count with index Z
 	}
+// 052-GCs3 counts the same nucleotides faster, many characters at a time (see ../common/base_counts.h)
 	
-	InFile.close();
+	if (Reader.next(Record))  cout << "!!! The file contains more than one sequence; only the first one was counted\n";
+	if (Reader.failed())  return 1;  // a damaged gzip file (see 050-GCs1)
 
 // At this point, the value Counts[i] contains the number of times the character with ASCII code i appears
-// in the file (after skipping the first line)
+// in the sequence
 // This simplifies the loop, which is desirable because the loop runs millions of times, so to make the code
 // efficient, you want to make it as simple as possible. However, you now have to do some work to add up the
 // correct numbers:
-	int AT=Counts['A']+Counts['T']+Counts['a']+Counts['t']+Counts['U']+Counts['u']+Counts['W']+Counts['w'];
-	int GC=Counts['G']+Counts['C']+Counts['g']+Counts['c']+Counts['S']+Counts['s'];
-	int Length=AT+GC+Counts['R']+Counts['Y']+Counts['M']+Counts['K']+Counts['B']+Counts['D']+Counts['H']+Counts['V']+Counts['N']
-	                 +Counts['r']+Counts['y']+Counts['m']+Counts['k']+Counts['b']+Counts['d']+Counts['h']+Counts['v']+Counts['n'];
+	long long AT=Counts['A']+Counts['T']+Counts['a']+Counts['t']+Counts['U']+Counts['u']+Counts['W']+Counts['w'];
+	long long GC=Counts['G']+Counts['C']+Counts['g']+Counts['c']+Counts['S']+Counts['s'];
+	long long Length=AT+GC+Counts['R']+Counts['Y']+Counts['M']+Counts['K']+Counts['B']+Counts['D']+Counts['H']+Counts['V']+Counts['N']
+	                       +Counts['r']+Counts['y']+Counts['m']+Counts['k']+Counts['b']+Counts['d']+Counts['h']+Counts['v']+Counts['n'];
 	
 	
 // Now just print the results:
@@ -1,19 +1,25 @@
 ﻿/*
 Find GC content and length of a DNA sequence in a FASTA file -- Alternative 2
 
-Using getline() instead of get() to read the file
+Reading the sequence lines as they are in the file instead of a copy of the sequence without line breaks
 
 Input:
 A file with a single DNA sequence in FASTA format (https://en.wikipedia.org/wiki/FASTA_format)
+Optionally, the name of one sequence in a larger FASTA file, or a region of it (name:start-end)
+Instead of a FASTA file, a packed file made earlier with --save-packed (2 bits per nucleotide)
 
 Output:
 Length of the sequence (number of nucleotides)
 GC content (% G-C base pairs) 
+With --all, a table with the length, GC content and the numbers of A-T, G-C and ambiguous nucleotides of every
+sequence in the file, counted on several threads
 
 
 Learning objetive: 
 1. ASCII code
 2. Practice using arrays
+3. Storing data compactly in bits
+4. Splitting work between threads
 
 Code written by Jan Mrazek, mrazek@uga.edu
 
@@ -22,64 +28,317 @@ Code written by Jan Mrazek, mrazek@uga.edu
 
 
 #include <iostream>
-#include <fstream>  // container that includes the class ifstream
 #include <string>  // container that includes the class string
+#include <vector>
+#include <string_view>
+#include <cstdint> // integer types with a fixed number of bits, such as uint64_t
+#include <cctype>
+#include <thread>  // running parts of the program at the same time on several processor cores
+#include <atomic>
+
+#include "../common/fasta_reader.h"  // the FASTA reader shared by all programs in this repository (class FastaReader)
+#include "../common/fasta_index.h"   // reading one sequence of a FASTA file by its name (class IndexedFasta)
+#include "../common/packed_dna.h"    // sequences stored in 2 bits per nucleotide (class PackedSequence)
+#include "../common/base_counts.h"   // counting nucleotides many characters at a time (countBases)
 
 using namespace std;
 
+// With --all the program counts every sequence in the file. Each sequence gets one of these to hold its counts.
+// A struct is a class that just groups a few variables together.
+// The counters are long long, integers of 64 bits: an int has 32 bits and cannot count past 2,147,483,647, fewer
+// nucleotides than there are in the human genome.
+struct SequenceCounts  {
+	string Name;  // the header up to the first space, without the >
+	long long GC;
+	long long AT;
+	long long Ambiguous;
+};
+
+// Bytes of the file each thread takes at a time with --all
+const size_t CHUNK_BYTES=8<<20;
+
+// The name of a sequence: its header line up to the first space, without the >
+string sequenceName(string_view Header)  {
+	size_t End=1;
+	while (End<Header.size() && !isspace((unsigned char)Header[End]))  ++End;
+	return string(Header.substr(1,End-1));
+}
+
+// Add the nucleotides in some lines of a FASTA file (ends of lines included) to Counted, the same way main() counts them
+void countLines(string_view Lines, SequenceCounts& Counted)  {
+	BaseCounts Counts=countBases(Lines);
+	Counted.AT+=Counts.at;
+	Counted.GC+=Counts.gc;
+	Counted.Ambiguous+=Counts.ambiguous;
+}
+
+// Count every sequence the reader gives and add one row per sequence to Report
+void countRecords(FastaReader& Reader, vector<SequenceCounts>& Report)  {
+	FastaRecord Record;
+	while (Reader.next(Record))  {
+		if (Record.header.empty())  continue;  // text before the first header
+		SequenceCounts Counted={sequenceName(Record.header), 0, 0, 0};
+		countLines(Record.lines, Counted);
+		Report.push_back(Counted);
+	}
+}
+
+// Count every sequence of a FASTA file on Threads threads; false if the file cannot be opened or is damaged gzip data.
+// The file is mapped into memory and cut into chunks of about CHUNK_BYTES that end where a sequence ends. Each thread
+// takes the next chunk not taken yet and writes its rows to that chunk's own list, so no two threads ever write to
+// the same place, and joining the lists in chunk order gives the rows in file order however many threads there are.
+// A compressed file or a pipe cannot be cut like that; it is read on one thread (decompression runs on others).
+bool countFastaRecords(const char* FileName, unsigned Threads, vector<SequenceCounts>& Report)  {
+	MappedFile File;
+	if (!File.open(FileName) || isGzipData(File.data, File.size))  {
+		FastaReader Reader(false);
+		if (!Reader.open(FileName))  return false;
+		countRecords(Reader, Report);
+		return !Reader.failed();
+	}
+
+	vector<size_t> Boundaries(1,0);  // chunk c holds the sequences starting from Boundaries[c] up to Boundaries[c+1]
+	for (size_t Target=CHUNK_BYTES;Target<File.size;Target+=CHUNK_BYTES)  {
+		size_t Boundary=nextFastaRecord(File.data, File.size, max(Target, Boundaries.back()+1));
+		if (Boundary>=File.size)  break;
+		Boundaries.push_back(Boundary);
+	}
+	Boundaries.push_back(File.size);
+
+	vector<vector<SequenceCounts> > Chunks(Boundaries.size()-1);
+	atomic<size_t> NextChunk(0);
+// atomic<size_t> is a number that several threads can increase at the same time without losing any of the increases,
+// so each chunk is handed to exactly one thread
+	vector<thread> Workers;
+	for (unsigned t=0;t<Threads;++t)  {
+		Workers.push_back(thread([&]  {
+			FastaReader Reader(false);
+			for (size_t c=NextChunk++;c<Chunks.size();c=NextChunk++)  {
+				Reader.attach(File.data+Boundaries[c], Boundaries[c+1]-Boundaries[c], Boundaries[c]);
+				countRecords(Reader, Chunks[c]);
+			}
+		}));
+	}
+// thread([&] { ... }) starts a new thread that runs the code in the braces (a lambda function) while main() goes on
+	for (unsigned t=0;t<Threads;++t)  Workers[t].join();
+// join() waits until the thread has finished
+
+	for (size_t c=0;c<Chunks.size();++c)  Report.insert(Report.end(), Chunks[c].begin(), Chunks[c].end());
+	return true;
+}
+
+// Count every sequence of a packed file on Threads threads, one row per sequence in file order
+void countPackedRecords(const vector<PackedRecord>& Records, unsigned Threads, vector<SequenceCounts>& Report)  {
+	Report.resize(Records.size());
+	atomic<size_t> Next(0);
+	vector<thread> Workers;
+	for (unsigned t=0;t<Threads;++t)  {
+		Workers.push_back(thread([&]  {
+			for (size_t i=Next++;i<Records.size();i=Next++)  {
+				BaseCounts Counted=Records[i].sequence.counts();
+				SequenceCounts Row={sequenceName(Records[i].header), (long long)Counted.gc, (long long)Counted.at, (long long)Counted.ambiguous};
+				Report[i]=Row;
+			}
+		}));
+	}
+	for (unsigned t=0;t<Threads;++t)  Workers[t].join();
+}
+
+// Print one row of the --all table
+void printRow(const SequenceCounts& Counted)  {
+	cout << Counted.Name << "\t" << Counted.GC+Counted.AT+Counted.Ambiguous << "\t";
+	if (Counted.GC+Counted.AT>0)  cout << 100.0*Counted.GC/(Counted.GC+Counted.AT);
+	else  cout << "NA";
+	cout << "\t" << Counted.AT << "\t" << Counted.GC << "\t" << Counted.Ambiguous << "\n";
+}
+
+// Print the --all table: one row per sequence and a row with the totals
+void printReport(const vector<SequenceCounts>& Report)  {
+	cout << "Sequence\tLength\tGC%\tAT\tGC\tAmbiguous\n";
+	SequenceCounts Total={"Total", 0, 0, 0};
+	for (size_t i=0;i<Report.size();++i)  {
+		printRow(Report[i]);
+		Total.GC+=Report[i].GC;
+		Total.AT+=Report[i].AT;
+		Total.Ambiguous+=Report[i].Ambiguous;
+	}
+	printRow(Total);
+}
+
 int main(int argc, char **argv) {
 
 	if (argc<2)  {
-		cout << "Use as:  " << argv[0] << " <FASTA_file_name>\n";
-		cout << "!!! The file can contain only one sequence\n";
+		cout << "Use as:  " << argv[0] << " <FASTA_or_packed_file> [<sequence_name> or <name>:<start>-<end>] [--save-packed <file>]\n";
+		cout << "        " << argv[0] << " <FASTA_or_packed_file> --all [--threads <n>] [--save-packed <file>]\n";
+		cout << "!!! Without a sequence name or --all the file can contain only one sequence\n";
 		cout << "Example: " << argv[0] << " Ecoli.fasta\n";
+		cout << "Example: " << argv[0] << " genome.fasta chr2:10001-20000\n";
+		cout << "Example: " << argv[0] << " genome.fasta --save-packed genome.packed   and later   " << argv[0] << " genome.packed chr2\n";
+		cout << "Example: " << argv[0] << " assembly.fasta --all --threads 8\n";
 		return 1;
 	}
 	
-	ifstream InFile(argv[1]);
-	if (!InFile.is_open())  {
-		cout << "Cannot open file \"" << argv[1] << "\"\n";
+	string RegionText;
+	string PackedFile;
+	bool AllSequences=false;
+	unsigned Threads=max(1u, thread::hardware_concurrency());
+// thread::hardware_concurrency() is the number of threads the computer can run at the same time (0 if it cannot tell)
+	for (int i=2;i<argc;++i)  {
+		string Argument=argv[i];
+		if (Argument=="--save-packed" && i+1<argc)  PackedFile=argv[++i];
+		else if (Argument=="--all")  AllSequences=true;
+		else if (Argument=="--threads" && i+1<argc)  {
+			int Value;
+			try  {
+				Value=stoi(argv[++i]);
+			}
+			catch (...)  {
+				Value=0;
+			}
+// stoi converts text to an int; if the text is not a number it throws an exception, which catch (...) catches
+			if (Value<=0)  {
+				cout << "Number of threads must be a positive integer\n";
+				return 1;
+			}
+			Threads=Value;
+		}
+		else if (RegionText.empty() && Argument.compare(0,2,"--")!=0)  RegionText=Argument;
+		else  {
+			cout << "Unknown option \"" << Argument << "\"\n";
+			return 1;
+		}
+	}
+// The arguments after the file name may come in any order: the name of a sequence (or a region), and the option
+// --save-packed followed by the name of the file to save the packed sequences in. Argument.compare(0,2,"--") compares
+// the first two characters of Argument with "--" and returns 0 if they are the same.
+	if (AllSequences && !RegionText.empty())  {
+		cout << "--all counts every sequence and cannot be combined with a sequence name\n";
 		return 1;
 	}
-	
-// opening the file is the same
 
-	string Line;
-// I created a string called Line without assigning any value to it.
-	
-	getline(InFile,Line);
-// This reads a line (until a '\n' character or end of file) from the stream InFile and stores it in the string Line.
-// getline returns true if the line is read successfully, false upon failure, but in this case we do not use the return value.
-	
-	if (Line[0]!='>' || Line.empty())  {
-// Line[0] refers to the first character of the string Line. 
-// Line.empty() is true if Line is an empty string (has length 0)
-		cout << "The file does not appear to be in FASTA format\n";
-		return 1;
+	if (isPackedFile(argv[1]) || !PackedFile.empty())  {
+// A packed file keeps each nucleotide in 2 bits (A=00, C=01, G=10, T=11) instead of the 8 bits of a character, so it
+// is 4 times smaller than the FASTA text and is loaded without reading the text again. Other characters, mostly runs
+// of N, are listed separately. See ../common/packed_dna.h for how the G and C are counted 32 nucleotides at a time.
+		vector<PackedRecord> Records;
+		string Error;
+		if (isPackedFile(argv[1]))  {
+			if (!PackedFile.empty())  {
+				cout << "The file is already packed\n";
+				return 1;
+			}
+			if (!readPackedFile(argv[1], Records, Error))  {
+				cout << Error << "\n";
+				return 1;
+			}
+		}
+		else  {
+			if (!packFastaFile(argv[1], Records))  {
+				cout << "Cannot read file \"" << argv[1] << "\"\n";
+				return 1;
+			}
+			if (Records.empty())  {
+				cout << "The file does not appear to be in FASTA format\n";
+				return 1;
+			}
+			if (!writePackedFile(PackedFile, Records))  {
+				cout << "Cannot write file \"" << PackedFile << "\"\n";
+				return 1;
+			}
+			cout << "Saved " << Records.size() << " packed sequence(s) to " << PackedFile << "\n";
+		}
+		if (Records.empty())  {
+			cout << "The packed file holds no sequences\n";
+			return 1;
+		}
+
+		if (AllSequences)  {
+			vector<SequenceCounts> Report;
+			countPackedRecords(Records, Threads, Report);
+			printReport(Report);
+			return 0;
+		}
+
+// Which sequence (and which part of it) to count: the first one, or the one the user named
+		FastaIndex Names;
+		indexPackedRecords(Records, Names);
+		FastaRegion Region={&Names.records()[0], 0, Records[0].sequence.size(), true};
+		if (!RegionText.empty() && !parseRegion(Names, RegionText, Region, Error))  {
+			cout << Error << "\n";
+			return 1;
+		}
+		if (RegionText.empty() && Records.size()>1)  cout << "!!! The file contains more than one sequence; only the first one was counted\n";
+
+		BaseCounts Counted=Records[Region.entry-&Names.records()[0]].sequence.counts(Region.start, Region.end);
+// Region.entry points to an element of the list of names; subtracting the address of the first element gives its
+// position in the list, which is also the position of the sequence in Records.
+		cout << "Sequence length: " << Counted.length() << " nucleotides\n";
+		cout << "GC content: " << 100.0*Counted.gc/(Counted.gc+Counted.at) << "%\n";
+		return 0;
 	}
-	
-	int Counts[128]={};
-
-	while (getline(InFile,Line))  {
-// reads the next line from the file into the string Line and stops the loop when reading fails (e.g., when the end of the file is reached.
-// Note that this time I am using the return value of getline to determine if I reached the end of the file or not.
-// The prior content of Line is lost but I don't need it anymore.
-		for (int i=0;i<Line.size();++i)  ++Counts[Line[i]];
-// Line.size() returns the size (number of characters) of the string Line. Line.length() does the same thing and can also be used.
-// The for loop runs through all characters Line[i] in the string Line and increments the counter with index Line[i]
+
+// Otherwise the FASTA text is read and counted as before.
+	if (AllSequences)  {
+		vector<SequenceCounts> Report;
+		if (!countFastaRecords(argv[1], Threads, Report))  {
+			cout << "Cannot read file \"" << argv[1] << "\"\n";
+			return 1;
+		}
+		if (Report.empty())  {
+			cout << "The file does not appear to be in FASTA format\n";
+			return 1;
+		}
+		printReport(Report);
+		return 0;
+	}
+
+	FastaReader Reader(false);
+	IndexedFasta Indexed(false);
+// This time I pass false to the constructor of FastaReader. The reader then does not join the lines of the sequence
+// into Record.sequence; it only tells us where the lines are, ends of lines included, in Record.lines. When a sequence
+// is spread over many lines, joining them means copying the whole sequence, and we can avoid that because
+// the counts below do not care where the lines end. IndexedFasta, which reads a named sequence, takes the same option.
+	FastaRecord Record;
+	if (!RegionText.empty())  {
+		string Error;
+		if (!Indexed.open(argv[1], Error) || !Indexed.fetch(RegionText, Record, Error))  {
+			cout << Error << "\n";
+			return 1;
+		}
+	}
+	else  {
+		if (!Reader.open(argv[1]))  {
+			cout << "Cannot open file \"" << argv[1] << "\"\n";
+			return 1;
+		}
+		
+// opening the file is the same
+
+		if (!Reader.next(Record) || Record.header.empty())  {
+// Record.header.empty() is true if the header is an empty string (has length 0), which is how the reader
+// tells us that the file does not start with a header line
+			cout << "The file does not appear to be in FASTA format\n";
+			return 1;
+		}
 	}
 	
-// Note: you can combine get() and getline() (and also other forms of input) when reading from a stream.
-// For example, you could use getline() to read the first line, and then use get() in the loop to read 
-// the sequence as we did in the previous versions of this program. The next read always starts from where the
-// previous ended, even if you combine diffeernt functions.
+	BaseCounts Counts=countBases(Record.lines);
+// countBases (see ../common/base_counts.h) does the same as the loop of the previous version,
+//	for (char Z : Record.sequence)  ++Counts[Z];
+// but faster. That loop makes the processor add 1 to the same counter again and again whenever a nucleotide repeats,
+// and each addition has to wait until the previous one is done. countBases instead compares 16, 32 or 64 characters
+// at once with each nucleotide code (with the SSE2, AVX2 or AVX-512 instructions, whichever the processor has) and
+// counts the matches. It needs no separate pass over the ends of lines: they are counted as "other" characters,
+// which are not added to the length below.
 	
-	InFile.close();
+	if (Reader.next(Record))  cout << "!!! The file contains more than one sequence; only the first one was counted\n";
+	if (Reader.failed())  return 1;  // a damaged gzip file (see 050-GCs1)
 
-	int AT=Counts['A']+Counts['T']+Counts['a']+Counts['t']+Counts['U']+Counts['u']+Counts['W']+Counts['w'];
-	int GC=Counts['G']+Counts['C']+Counts['g']+Counts['c']+Counts['S']+Counts['s'];
-	int Length=AT+GC+Counts['R']+Counts['Y']+Counts['M']+Counts['K']+Counts['B']+Counts['D']+Counts['H']+Counts['V']+Counts['N']
-	                 +Counts['r']+Counts['y']+Counts['m']+Counts['k']+Counts['b']+Counts['d']+Counts['h']+Counts['v']+Counts['n'];
+// The counts are 64-bit numbers, so sequences longer than 2,147,483,647 nucleotides, the largest number an int can
+// hold, are counted correctly.
+	long long AT=Counts.at;
+	long long GC=Counts.gc;
+	long long Length=Counts.length();
 	
 	cout << "Sequence length: " << Length << " nucleotides\n";
 	cout << "GC content: " << 100.0*GC/(GC+AT) << "%\n";
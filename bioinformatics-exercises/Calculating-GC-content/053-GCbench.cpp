@@ -0,0 +1,179 @@
+﻿/*
+Measure how fast the nucleotides of a sequence can be counted
+
+Compares the counting loop of 051-GCs2 (one counter per character code, ++Counts[Z]) with the kernels of
+../common/base_counts.h that 052-GCs3 uses: a portable one with four tables and the SSE2, AVX2 and AVX-512 ones,
+as many of them as the processor supports
+
+Input:
+Optionally, FASTA files (a real genome); their whole text is counted, headers and ends of lines included
+Optionally, --size <MB> (size of the made-up sequences, 256 by default) and --repeat <n> (runs of each count, 5 by
+default; the fastest is reported)
+
+Output:
+For every sequence and method, the speed in GB per second and the speed relative to the Counts table
+The program stops with an error if any method counts differently from the table
+
+
+Learning objective:
+1. Measuring the speed of code
+2. How the order of memory operations limits a simple loop
+3. Vector (SIMD) instructions chosen at run time
+
+*/
+
+
+
+#include <iostream>
+#include <iomanip>  // setprecision, setw
+#include <string>
+#include <vector>
+#include <chrono>   // clocks for timing
+#include <random>   // random number generators
+
+#include "../common/fasta_reader.h"  // MappedFile, to read a whole file into memory
+#include "../common/base_counts.h"   // countBases and its kernels
+
+using namespace std;
+
+// One thing to count: a name and the text
+struct BenchInput  {
+	string Name;
+	string Text;
+};
+
+// The counting loop of 051-GCs2 (with unsigned char, so that codes above 127 stay inside the array), turned into
+// BaseCounts so that it can be compared with the kernels
+BaseCounts countWithTable(const char* Text, size_t Size)  {
+	long long Counts[256]={};
+	for (size_t i=0;i<Size;++i)  ++Counts[(unsigned char)Text[i]];
+	BaseCounts Result={0, 0, 0, 0};
+	const unsigned char* Classes=baseClasses().of;
+	for (int Z=0;Z<256;++Z)  {
+		if (Classes[Z]==0)  Result.gc+=Counts[Z];
+		else if (Classes[Z]==1)  Result.at+=Counts[Z];
+		else if (Classes[Z]==2)  Result.ambiguous+=Counts[Z];
+		else  Result.other+=Counts[Z];
+	}
+	return Result;
+}
+
+// Made-up sequence of Size bytes in lines of 60 nucleotides. Each line is random nucleotides (Kind 0), runs of one
+// nucleotide or of N up to 2000 long, as in repeats and gaps of real genomes (Kind 1), or random upper and lower case
+// nucleotides with a few other IUPAC codes, as in soft-masked genomes (Kind 2).
+string makeSequence(size_t Size, int Kind)  {
+	mt19937_64 Random(12345+Kind);
+// mt19937_64 is a random number generator; Random() gives a new random 64-bit number every time. The fixed starting
+// value (seed) makes the sequence the same every time the program runs.
+	string Text;
+	Text.reserve(Size);
+	const char* Codes=(Kind==2) ? "ACGTacgtacgtRYKMSWNn" : "ACGT";
+	int CodeCount=(Kind==2) ? 20 : 4;
+	char Run='A';
+	long long RunLeft=0;
+	while (Text.size()<Size)  {
+		if (Text.size()%61==60)  {
+			Text+='\n';
+			continue;
+		}
+		if (Kind==1)  {
+			if (RunLeft==0)  {
+				Run="ACGTN"[Random()%5];
+				RunLeft=1+Random()%2000;
+			}
+			Text+=Run;
+			--RunLeft;
+		}
+		else  Text+=Codes[Random()%CodeCount];
+	}
+	return Text;
+}
+
+// Count Input with Count, Repeat times, and return the shortest time in seconds; Result gets the counts
+double timeCount(BaseCountFunction Count, const BenchInput& Input, int Repeat, BaseCounts& Result)  {
+	double Best=0.0;
+	for (int r=0;r<Repeat;++r)  {
+		chrono::steady_clock::time_point Start=chrono::steady_clock::now();
+		Result=Count(Input.Text.data(), Input.Text.size());
+		chrono::duration<double> Elapsed=chrono::steady_clock::now()-Start;
+// steady_clock measures time like a stopwatch; the difference of two time points is a duration, here in seconds
+		if (r==0 || Elapsed.count()<Best)  Best=Elapsed.count();
+	}
+// The fastest of several runs is the one least disturbed by other programs and by the first touch of the memory
+	return Best;
+}
+
+bool sameCounts(const BaseCounts& A, const BaseCounts& B)  {
+	return A.gc==B.gc && A.at==B.at && A.ambiguous==B.ambiguous && A.other==B.other;
+}
+
+int main(int argc, char **argv) {
+
+	size_t SizeMB=256;
+	int Repeat=5;
+	vector<string> Files;
+	for (int i=1;i<argc;++i)  {
+		string Argument=argv[i];
+		if ((Argument=="--size" || Argument=="--repeat") && i+1<argc)  {
+			int Value;
+			try  {
+				Value=stoi(argv[++i]);
+			}
+			catch (...)  {
+				Value=0;
+			}
+			if (Value<=0)  {
+				cout << Argument << " must be a positive integer\n";
+				return 1;
+			}
+			if (Argument=="--size")  SizeMB=Value;
+			else  Repeat=Value;
+		}
+		else if (Argument.compare(0,2,"--")!=0)  Files.push_back(Argument);
+		else  {
+			cout << "Use as:  " << argv[0] << " [<FASTA_file> ...] [--size <MB>] [--repeat <n>]\n";
+			cout << "Example: " << argv[0] << " genome.fasta --repeat 3\n";
+			return 1;
+		}
+	}
+
+	vector<BenchInput> Inputs;
+	Inputs.push_back(BenchInput{"random", makeSequence(SizeMB<<20, 0)});
+	Inputs.push_back(BenchInput{"runs", makeSequence(SizeMB<<20, 1)});
+	Inputs.push_back(BenchInput{"soft-masked", makeSequence(SizeMB<<20, 2)});
+	for (size_t f=0;f<Files.size();++f)  {
+		MappedFile File;
+		if (!File.open(Files[f].c_str()))  {
+			cout << "Cannot open file \"" << Files[f] << "\"\n";
+			return 1;
+		}
+		Inputs.push_back(BenchInput{Files[f], string(File.data, File.size)});
+// The file is copied into memory first so that reading it from the disk is not part of the time
+	}
+
+	vector<BaseCountKernel> Kernels=baseCountKernels();
+	cout << "countBases uses the " << bestBaseCountKernel().name << " kernel on this processor\n";
+	cout << left << setw(24) << "Input" << setw(10) << "MB" << setw(12) << "Method" << setw(10) << "GB/s" << "Speedup\n";
+	cout << fixed << setprecision(2);
+	for (size_t i=0;i<Inputs.size();++i)  {
+		const BenchInput& Input=Inputs[i];
+		BaseCounts Expected;
+		double TableTime=timeCount(countWithTable, Input, Repeat, Expected);
+		double MB=Input.Text.size()/1048576.0;
+		cout << setw(24) << Input.Name << setw(10) << MB << setw(12) << "Counts[]" << setw(10)
+		     << Input.Text.size()/TableTime/1e9 << "1.00\n";
+		for (size_t k=0;k<Kernels.size();++k)  {
+			BaseCounts Counted;
+			double Time=timeCount(Kernels[k].count, Input, Repeat, Counted);
+			if (!sameCounts(Counted, Expected))  {
+				cout << "The " << Kernels[k].name << " kernel counts " << Input.Name << " differently from the table\n";
+				return 1;
+			}
+			cout << setw(24) << Input.Name << setw(10) << MB << setw(12) << Kernels[k].name << setw(10)
+			     << Input.Text.size()/Time/1e9 << TableTime/Time << "\n";
+		}
+	}
+
+	return 0;
+
+}
@@ -0,0 +1,287 @@
+﻿/*
+Measure how fast FASTA files can be read
+
+Compares FastaReader from ../common/fasta_reader.h, the reader all programs in this repository use, with the loop the
+programs used before it: getline, trimming every line and appending it to the sequence. FastaReader is timed reading
+the file mapped into memory, as it does for a regular file, and streamed in blocks of 4 MB, as it does for a pipe or a
+gzip file. The mapped file is also read without joining the lines of a sequence (joinLines false, as 052-GCs3 does).
+
+Input:
+Optionally, FASTA files, plain or gzip-compressed (these can only be streamed); without any, a made-up genome and a
+made-up set of proteins are written to temporary files
+Optionally, --size <MB> (size of each made-up file, 256 by default) and --repeat <n> (runs of each method, 5 by
+default; the fastest is reported)
+
+Output:
+For every file and method, the speed in GB of FASTA text (uncompressed) per second and the speed relative to getline
+The program stops with an error if any method finds different records than getline
+
+
+Learning objective:
+1. Measuring the speed of reading a file
+2. What copying every line costs
+3. Memory-mapped files
+
+*/
+
+
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>  // setprecision, setw
+#include <string>
+#include <vector>
+#include <chrono>   // clocks for timing
+#include <random>   // random number generators
+#include <cstdio>   // remove
+#include <cstdlib>  // mkstemp
+
+#include "../common/fasta_reader.h"  // FastaReader, MappedFile
+#include "../common/gzip_input.h"    // InputFile, which reads plain and gzip-compressed files alike
+
+using namespace std;
+
+// What a method found in a file: the records that have a header, and the letters of their sequences
+struct ReadTally  {
+	long long Records;
+	long long Letters;
+};
+
+// One file to read: a name to print and where it is
+struct BenchFile  {
+	string Name;
+	string Path;
+	bool Temporary;  // made up by this program, deleted at the end
+};
+
+// A line without the spaces, tabs and carriage returns (of Windows files) at its ends
+void trimLine(string& Line)  {
+	size_t End=Line.size();
+	while (End>0 && (Line[End-1]==' ' || Line[End-1]=='\t' || Line[End-1]=='\r'))  --End;
+	size_t Start=0;
+	while (Start<End && (Line[Start]==' ' || Line[Start]=='\t'))  ++Start;
+	Line=Line.substr(Start, End-Start);
+}
+
+// The way the programs read FASTA files before FastaReader: line by line, every sequence line copied onto the end of
+// the sequence
+ReadTally readWithGetline(const string& Path)  {
+	ReadTally Tally={0, 0};
+	InputFile File(Path);
+	string Line, Header, Sequence;
+	bool InRecord=false;
+	while (getline(File, Line))  {
+		trimLine(Line);
+		if (!Line.empty() && Line[0]=='>')  {
+			if (InRecord)  {
+				++Tally.Records;
+				Tally.Letters+=Sequence.size();
+			}
+			Header=Line;
+			Sequence.clear();
+			InRecord=true;
+		}
+		else if (InRecord)  Sequence+=Line;
+	}
+	if (InRecord)  {
+		++Tally.Records;
+		Tally.Letters+=Sequence.size();
+	}
+	return Tally;
+}
+
+// All records of a reader. With Joined false the reader does not remove the ends of lines, so only the records are
+// counted.
+ReadTally readRecords(FastaReader& Reader, bool Joined)  {
+	ReadTally Tally={0, 0};
+	FastaRecord Record;
+	while (Reader.next(Record))  {
+		if (Record.header.empty())  continue;  // text before the first header
+		++Tally.Records;
+		if (Joined)  Tally.Letters+=Record.sequence.size();
+	}
+	if (Reader.failed())  Tally.Records=-1;
+	return Tally;
+}
+
+// FastaReader reading the file in blocks, as it reads a pipe
+ReadTally readStreamed(const string& Path)  {
+	InputFile File(Path);
+	FastaReader Reader;
+	Reader.attach(File);
+	return readRecords(Reader, true);
+}
+
+// FastaReader reading the file mapped into memory
+ReadTally readMapped(const string& Path)  {
+	FastaReader Reader;
+	Reader.open(Path);
+	return readRecords(Reader, true);
+}
+
+// The same, without joining the lines of the sequences
+ReadTally readMappedLines(const string& Path)  {
+	FastaReader Reader(false);
+	Reader.open(Path);
+	return readRecords(Reader, false);
+}
+
+// Bytes of text in a file, after decompression if it is compressed; -1 if it cannot be read
+long long textSize(const string& Path)  {
+	InputFile File(Path);
+	if (!File.is_open())  return -1;
+	vector<char> Block(1<<20);
+	long long Size=0;
+	while (File.read(Block.data(), Block.size()) || File.gcount()>0)  Size+=File.gcount();
+	return File.failed() ? -1 : Size;
+}
+
+// Read the file with Method, Repeat times, and return the shortest time in seconds; Tally gets what was found
+double timeRead(ReadTally (*Method)(const string&), const string& Path, int Repeat, ReadTally& Tally)  {
+	double Best=0.0;
+	for (int r=0;r<Repeat;++r)  {
+		chrono::steady_clock::time_point Start=chrono::steady_clock::now();
+		Tally=Method(Path);
+		chrono::duration<double> Elapsed=chrono::steady_clock::now()-Start;
+		if (r==0 || Elapsed.count()<Best)  Best=Elapsed.count();
+	}
+// After the first run (and the size count before it) the file is in the page cache, the copy of recently read files
+// that the operating system keeps in memory, so the fastest run measures the reading code rather than the disk
+	return Best;
+}
+
+// Write a made-up FASTA file of about Size bytes to a new temporary file and return its path (empty if it cannot be
+// written). Kind 0 is a genome: sequences of 16 MB of random nucleotides. Kind 1 is a set of proteins of 50 to 1000
+// random amino acids, so the time spent on each record, not only on each byte, counts. Lines are 60 letters long.
+string makeFastaFile(size_t Size, int Kind)  {
+	char Path[]="/tmp/054-ReaderBench-XXXXXX";
+	int Descriptor=mkstemp(Path);
+// mkstemp replaces the XXXXXX with characters that make the name of a file that does not exist yet, and creates it
+	if (Descriptor<0)  return string();
+	close(Descriptor);
+
+	mt19937_64 Random(12345+Kind);
+	const char* Letters=(Kind==0) ? "ACGT" : "ACDEFGHIKLMNPQRSTVWY";
+	int LetterCount=(Kind==0) ? 4 : 20;
+	string Text;
+	Text.reserve(Size+(1<<20));
+	for (long long Record=1;Text.size()<Size;++Record)  {
+		Text+=(Kind==0) ? ">chr" : ">protein";
+		Text+=to_string(Record);
+		Text+='\n';
+		size_t Length=(Kind==0) ? (16<<20) : 50+Random()%951;
+		for (size_t i=0;i<Length;++i)  {
+			Text+=Letters[Random()%LetterCount];
+			if (i%60==59 || i+1==Length)  Text+='\n';
+		}
+	}
+	ofstream File(Path, ios::binary);
+	File.write(Text.data(), Text.size());
+	if (!File)  {
+		remove(Path);
+		return string();
+	}
+	return Path;
+}
+
+bool sameTally(const ReadTally& A, const ReadTally& B, bool Joined)  {
+	return A.Records==B.Records && (!Joined || A.Letters==B.Letters);
+}
+
+// Time every method on every file; false if a method finds different records than getline
+bool runBench(const vector<BenchFile>& Files, int Repeat)  {
+	cout << left << setw(24) << "Input" << setw(10) << "MB" << setw(14) << "Method" << setw(10) << "GB/s" << "Speedup\n";
+	cout << fixed << setprecision(2);
+	for (size_t f=0;f<Files.size();++f)  {
+		const BenchFile& File=Files[f];
+		long long Size=textSize(File.Path);
+		if (Size<0)  {
+			cout << "Cannot read file \"" << File.Path << "\"\n";
+			return false;
+		}
+		MappedFile Mapped;
+		bool Compressed=Mapped.open(File.Path.c_str()) && isGzipData(Mapped.data, Mapped.size);
+		Mapped.close();
+// A compressed file cannot be read in place, so it is only streamed (FastaReader.open() would stream it too)
+
+		ReadTally Expected;
+		double GetlineTime=timeRead(readWithGetline, File.Path, Repeat, Expected);
+		double MB=Size/1048576.0;
+		cout << setw(23) << File.Name << " " << setw(10) << MB << setw(14) << "getline" << setw(10)
+		     << Size/GetlineTime/1e9 << "1.00\n";
+
+		struct Method  {
+			const char* Name;
+			ReadTally (*Read)(const string&);
+			bool Joined;
+		};
+		vector<Method> Methods;
+		Methods.push_back(Method{"streamed", readStreamed, true});
+		if (!Compressed)  {
+			Methods.push_back(Method{"mapped", readMapped, true});
+			Methods.push_back(Method{"mapped-lines", readMappedLines, false});
+		}
+		for (size_t m=0;m<Methods.size();++m)  {
+			ReadTally Found;
+			double Time=timeRead(Methods[m].Read, File.Path, Repeat, Found);
+			if (!sameTally(Found, Expected, Methods[m].Joined))  {
+				cout << "The " << Methods[m].Name << " reader finds different records in " << File.Name << " than getline\n";
+				return false;
+			}
+			cout << setw(23) << File.Name << " " << setw(10) << MB << setw(14) << Methods[m].Name << setw(10)
+			     << Size/Time/1e9 << GetlineTime/Time << "\n";
+		}
+	}
+	return true;
+}
+
+int main(int argc, char **argv) {
+
+	size_t SizeMB=256;
+	int Repeat=5;
+	vector<BenchFile> Files;
+	for (int i=1;i<argc;++i)  {
+		string Argument=argv[i];
+		if ((Argument=="--size" || Argument=="--repeat") && i+1<argc)  {
+			int Value;
+			try  {
+				Value=stoi(argv[++i]);
+			}
+			catch (...)  {
+				Value=0;
+			}
+			if (Value<=0)  {
+				cout << Argument << " must be a positive integer\n";
+				return 1;
+			}
+			if (Argument=="--size")  SizeMB=Value;
+			else  Repeat=Value;
+		}
+		else if (Argument.compare(0,2,"--")!=0)  Files.push_back(BenchFile{Argument, Argument, false});
+		else  {
+			cout << "Use as:  " << argv[0] << " [<FASTA_file> ...] [--size <MB>] [--repeat <n>]\n";
+			cout << "Example: " << argv[0] << " genome.fasta genome.fasta.gz --repeat 3\n";
+			return 1;
+		}
+	}
+
+	if (Files.empty())  {
+		const char* Names[2]={"made-up genome", "made-up proteins"};
+		for (int Kind=0;Kind<2;++Kind)  {
+			string Path=makeFastaFile(SizeMB<<20, Kind);
+			if (Path.empty())  {
+				cout << "Cannot write a temporary file\n";
+				for (size_t f=0;f<Files.size();++f)  remove(Files[f].Path.c_str());
+				return 1;
+			}
+			Files.push_back(BenchFile{Names[Kind], Path, true});
+		}
+	}
+
+	bool Ok=runBench(Files, Repeat);
+	for (size_t f=0;f<Files.size();++f)  {
+		if (Files[f].Temporary)  remove(Files[f].Path.c_str());
+	}
+	return Ok ? 0 : 1;
+
+}
@@ -4,38 +4,434 @@ written by Kimberly Casares */
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <vector>
+#include <sstream>
+#include <cstring>
+#include <cstdint>
+#include <climits>
+#include <cmath>
+#include <thread>
+#include <atomic>
+#include <deque>
+#include <string_view>
+
+#include "../common/fasta_reader.h"
+#include "../common/fasta_index.h"
+#include "../common/top_k.h"
 
 using namespace std;
 
-// First define struct
+// First define struct. A ranked protein is kept as a top list entry whose score is the ranking
+// metric and whose key is the byte offset of the header in the file, which breaks ties in file order.
 struct ProteinInfo {
-    double hydrophobicPercent;
-    string name;
+    vector<double> values;  // every printed metric, in column order
+    string_view name;       // the header, in the mapped file or in the reader's saved headers
     long length;
+    long segmentStart;      // best hydropathy window, 1-based and inclusive (window mode)
+    long segmentEnd;
+};
+
+typedef TopK<ProteinInfo> TopList;
+
+// Proteins listed unless --top says otherwise
+const size_t DEFAULT_TOP_COUNT = 15;
+
+// Residue counts of one sequence, indexed by byte value
+struct ResidueHistogram {
+    uint64_t counts[256];
+    uint64_t length;
+};
+
+// Count every byte of a sequence in one pass. Four interleaved tables keep runs of the same
+// residue from waiting on each other's increments; there is no branch per residue.
+void countResidues(const char* sequence, size_t length, ResidueHistogram& histogram) {
+    uint32_t lanes[4][256];
+    memset(lanes, 0, sizeof(lanes));
+    const unsigned char* bytes = (const unsigned char*)sequence;
+    size_t i = 0;
+    for(; i + 4 <= length; i += 4) {
+        lanes[0][bytes[i]]++;
+        lanes[1][bytes[i + 1]]++;
+        lanes[2][bytes[i + 2]]++;
+        lanes[3][bytes[i + 3]]++;
+    }
+    for(; i < length; i++) {
+        lanes[0][bytes[i]]++;
+    }
+    for(int c = 0; c < 256; c++) {
+        histogram.counts[c] = uint64_t(lanes[0][c]) + lanes[1][c] + lanes[2][c] + lanes[3][c];
+    }
+    histogram.length = length;
+}
+
+// Kyte-Doolittle hydropathy of each amino acid, by letter
+double kyteDoolittle(char aa) {
+    switch(aa) {
+        case 'A': return 1.8;   case 'R': return -4.5;  case 'N': return -3.5;  case 'D': return -3.5;
+        case 'C': return 2.5;   case 'Q': return -3.5;  case 'E': return -3.5;  case 'G': return -0.4;
+        case 'H': return -3.2;  case 'I': return 4.5;   case 'L': return 3.8;   case 'K': return -3.9;
+        case 'M': return 1.9;   case 'F': return 2.8;   case 'P': return -1.6;  case 'S': return -0.8;
+        case 'T': return -0.7;  case 'W': return -0.9;  case 'Y': return -1.3;  case 'V': return 4.2;
+    }
+    return 0;
+}
+
+// Average mass of each amino acid residue (Da), by letter
+double residueMass(char aa) {
+    switch(aa) {
+        case 'A': return 71.0788;   case 'R': return 156.1875;  case 'N': return 114.1038;  case 'D': return 115.0886;
+        case 'C': return 103.1388;  case 'Q': return 128.1307;  case 'E': return 129.1155;  case 'G': return 57.0519;
+        case 'H': return 137.1411;  case 'I': return 113.1594;  case 'L': return 113.1594;  case 'K': return 128.1741;
+        case 'M': return 131.1926;  case 'F': return 147.1766;  case 'P': return 97.1167;   case 'S': return 87.0782;
+        case 'T': return 101.1051;  case 'W': return 186.2132;  case 'Y': return 163.1760;  case 'V': return 99.1326;
+    }
+    return 0;
+}
+
+const char* AMINO_ACIDS = "ARNDCQEGHILKMFPSTWYV";
+const double WATER_MASS = 18.01528;
+
+// Net charge at a given pH from side-chain and terminal pKa values (EMBOSS set)
+double netCharge(const ResidueHistogram& histogram, double pH) {
+    const uint64_t* n = histogram.counts;
+    double positive = 1 / (1 + pow(10, pH - 8.6))                    // N-terminus
+                    + n['K'] / (1 + pow(10, pH - 10.8))
+                    + n['R'] / (1 + pow(10, pH - 12.5))
+                    + n['H'] / (1 + pow(10, pH - 6.5));
+    double negative = 1 / (1 + pow(10, 3.6 - pH))                    // C-terminus
+                    + n['D'] / (1 + pow(10, 3.9 - pH))
+                    + n['E'] / (1 + pow(10, 4.1 - pH))
+                    + n['C'] / (1 + pow(10, 8.5 - pH))
+                    + n['Y'] / (1 + pow(10, 10.1 - pH));
+    return positive - negative;
+}
+
+// Isoelectric point: the pH where the net charge crosses zero, found by bisection
+double isoelectricPoint(const ResidueHistogram& histogram) {
+    double low = 0, high = 14;
+    for(int i = 0; i < 50; i++) {
+        double middle = (low + high) / 2;
+        if(netCharge(histogram, middle) > 0) {
+            low = middle;
+        }
+        else {
+            high = middle;
+        }
+    }
+    return (low + high) / 2;
+}
+
+// Hydropathy values are summed as integers in units of 1/10000, so a running window sum is exact
+// however many residues it has been updated over
+const double SCALE_UNITS = 10000;
+
+// A per-residue hydropathy scale and the sliding window it is averaged over
+struct WindowScale {
+    int32_t values[256];  // by byte value; residues not on the scale count 0
+    long width;
+};
+
+// Create a function to set up a scale from the Kyte-Doolittle values
+void kyteDoolittleScale(WindowScale& scale) {
+    for(int c = 0; c < 256; c++) {
+        scale.values[c] = (int32_t)lround(kyteDoolittle((char)c) * SCALE_UNITS);
+    }
+}
+
+// Create a function to read a user scale: one "<letter> <value>" pair per line, '#' starts a comment
+bool readScaleFile(const string& filename, WindowScale& scale) {
+    ifstream file(filename.c_str());
+    if(!file.is_open()) return false;
+    memset(scale.values, 0, sizeof(scale.values));
+    string line;
+    while(getline(file, line)) {
+        stringstream fields(line.substr(0, line.find('#')));
+        string letter;
+        double value;
+        if(!(fields >> letter)) continue;  // blank or comment line
+        if(letter.length() != 1 || !(fields >> value)) return false;
+        scale.values[(unsigned char)letter[0]] = (int32_t)lround(value * SCALE_UNITS);
+    }
+    return true;
+}
+
+// Highest-scoring window of one sequence
+struct WindowResult {
+    bool found;    // false if the sequence is shorter than the window
+    double best;   // mean hydropathy of the best window
+    long start;    // its first and last residue, 1-based
+    long end;
+};
+
+// Create a function to slide the window along a sequence in one pass. Each residue adds its value to
+// the running sum and the residue leaving the window (kept in a ring of the last `width` values)
+// takes its own back out, so the cost per residue is constant whatever the width. Line breaks (LF or
+// CRLF) are skipped, so the sequence can be scanned straight from the file; the first best window wins ties.
+void scanWindow(const char* sequence, size_t length, const WindowScale& scale, WindowResult& result) {
+    vector<int32_t> ring(scale.width);
+    int64_t sum = 0, bestSum = 0;
+    long count = 0, slot = 0;
+    result.found = false;
+    for(size_t i = 0; i < length; i++) {
+        unsigned char residue = sequence[i];
+        if(residue == '\n' || residue == '\r') continue;
+        int32_t value = scale.values[residue];
+        sum += value - ring[slot];  // the ring starts zeroed, so nothing leaves before it fills
+        ring[slot] = value;
+        if(++slot == scale.width) slot = 0;
+        count++;
+        if(count >= scale.width && (!result.found || sum > bestSum)) {
+            result.found = true;
+            bestSum = sum;
+            result.end = count;
+        }
+    }
+    if(result.found) {
+        result.best = bestSum / SCALE_UNITS / scale.width;
+        result.start = result.end - scale.width + 1;
+    }
+}
+
+// The metrics the tool can compute from a residue histogram
+enum MetricKind {
+    METRIC_COMPOSITION,  // percentage of residues from a set of letters
+    METRIC_CHARGE,       // net charge at pH 7
+    METRIC_GRAVY,        // mean Kyte-Doolittle hydropathy
+    METRIC_WEIGHT,       // molecular weight in Da
+    METRIC_PI,           // isoelectric point
+    METRIC_WINDOW        // best sliding-window hydropathy (from the sequence, not the histogram)
+};
+
+struct Metric {
+    MetricKind kind;
+    string residues;  // letters counted by a composition metric
+    string column;    // heading in the output table
+};
+
+// Names accepted by --rank and --metrics; "all" expands to the named metrics
+const char* METRIC_NAMES = "hydrophobic, aromatic, charge, gravy, mw, pi, composition:<letters>";
+
+// Create a function to turn a metric name into a Metric; false if the name is unknown
+bool parseMetric(const string& name, Metric& metric) {
+    metric.residues.clear();
+    if(name == "hydrophobic") {
+        metric.kind = METRIC_COMPOSITION;
+        metric.residues = "LIVFM";
+        metric.column = "%Hydrophobic";
+    }
+    else if(name == "aromatic") {
+        metric.kind = METRIC_COMPOSITION;
+        metric.residues = "FWY";
+        metric.column = "%Aromatic";
+    }
+    else if(name == "charge") {
+        metric.kind = METRIC_CHARGE;
+        metric.column = "Charge";
+    }
+    else if(name == "gravy") {
+        metric.kind = METRIC_GRAVY;
+        metric.column = "GRAVY";
+    }
+    else if(name == "mw") {
+        metric.kind = METRIC_WEIGHT;
+        metric.column = "MW";
+    }
+    else if(name == "pi") {
+        metric.kind = METRIC_PI;
+        metric.column = "pI";
+    }
+    else if(name.compare(0, 12, "composition:") == 0 && name.length() > 12) {
+        metric.kind = METRIC_COMPOSITION;
+        metric.residues = name.substr(12);
+        metric.column = "%" + metric.residues;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+// Create a function to parse a comma-separated list of metric names
+bool parseMetricList(const string& list, vector<Metric>& metrics) {
+    stringstream names(list);
+    string name;
+    while(getline(names, name, ',')) {
+        if(name == "all") {
+            if(!parseMetricList("hydrophobic,aromatic,charge,gravy,mw,pi", metrics)) return false;
+            continue;
+        }
+        Metric metric;
+        if(!parseMetric(name, metric)) return false;
+        metrics.push_back(metric);
+    }
+    return !metrics.empty();
+}
+
+// What one pass over a record yields: its histogram and, in window mode, its best window
+struct RecordSummary {
+    ResidueHistogram histogram;
+    WindowResult window;
+};
+
+// What to compute, rank by and print
+struct RankingSettings {
+    Metric rankMetric;
+    vector<Metric> columns;
+    bool windowed;      // scan every record with `scale`; the rank metric is then the window
+    WindowScale scale;
 };
 
-// Create a function to calculate hydrophobic percentage
-double calculateHydrophobic(const string& sequence) {
-    int hydrophobicCount = 0;
-    for(int i = 0; i < sequence.length(); i++) {
-        char aa = sequence[i];
-        if(aa == 'L' || aa == 'I' || aa == 'V' || aa == 'F' || aa == 'M') {
-            hydrophobicCount++;
+// Create a function to summarize a record's sequence; line breaks (LF or CRLF) in it are left out,
+// so it can be read straight from the file
+void summarizeRecord(const char* sequence, size_t length, const RankingSettings& settings, RecordSummary& summary) {
+    ResidueHistogram& histogram = summary.histogram;
+    countResidues(sequence, length, histogram);
+    histogram.length -= histogram.counts[(unsigned char)'\n'] + histogram.counts[(unsigned char)'\r'];
+    histogram.counts[(unsigned char)'\n'] = 0;
+    histogram.counts[(unsigned char)'\r'] = 0;
+    summary.window.found = false;
+    if(settings.windowed) {
+        scanWindow(sequence, length, settings.scale, summary.window);
+    }
+}
+
+// Create a function to calculate one metric from a record's summary
+double evaluateMetric(const Metric& metric, const RecordSummary& summary) {
+    const ResidueHistogram& histogram = summary.histogram;
+    const uint64_t* n = histogram.counts;
+    switch(metric.kind) {
+        case METRIC_COMPOSITION: {
+            uint64_t count = 0;
+            for(size_t i = 0; i < metric.residues.length(); i++) {
+                count += n[(unsigned char)metric.residues[i]];
+            }
+            return (100.0 * count) / histogram.length;
+        }
+        case METRIC_CHARGE:
+            return netCharge(histogram, 7.0);
+        case METRIC_GRAVY: {
+            double sum = 0;
+            for(const char* aa = AMINO_ACIDS; *aa; aa++) {
+                sum += n[(unsigned char)*aa] * kyteDoolittle(*aa);
+            }
+            return sum / histogram.length;
         }
+        case METRIC_WEIGHT: {
+            double mass = WATER_MASS;
+            for(const char* aa = AMINO_ACIDS; *aa; aa++) {
+                mass += n[(unsigned char)*aa] * residueMass(*aa);
+            }
+            return mass;
+        }
+        case METRIC_PI:
+            return isoelectricPoint(histogram);
+        case METRIC_WINDOW:
+            return summary.window.best;
     }
-    return (100.0 * hydrophobicCount) / sequence.length();
+    return 0;
 }
 
-// Create a function to handle sorting
-void insertIntoTop(ProteinInfo topProteins[], const ProteinInfo& newProtein) {
-    topProteins[15] = newProtein;
-    // Here's where sorting loop goes
-    for(int i = 15; i > 0; i--) {
-        if(topProteins[i].hydrophobicPercent > topProteins[i-1].hydrophobicPercent) {
-            ProteinInfo temp = topProteins[i];
-            topProteins[i] = topProteins[i-1];
-            topProteins[i-1] = temp;
+// Create a function to offer a summarized record to the top list. The printed metrics are only
+// derived, and the header only saved (when `savedHeaders` is given), for proteins that reach the
+// list; otherwise the list keeps a view of `header`, which must outlive it.
+void offerProtein(const char* header, size_t headerLength, long position, const RecordSummary& summary,
+                  const RankingSettings& settings, TopList& topProteins, deque<string>* savedHeaders) {
+    if(summary.histogram.length < 100) return;
+    if(settings.windowed && !summary.window.found) return;
+
+    double score = evaluateMetric(settings.rankMetric, summary);
+    if(!topProteins.accepts(score, position)) return;
+
+    ProteinInfo protein;
+    protein.name = string_view(header, headerLength);
+    if(savedHeaders != NULL) {
+        savedHeaders->push_back(string(protein.name));
+        protein.name = savedHeaders->back();
+    }
+    protein.length = summary.histogram.length;
+    protein.segmentStart = summary.window.start;
+    protein.segmentEnd = summary.window.end;
+    for(size_t m = 0; m < settings.columns.size(); m++) {
+        protein.values.push_back(evaluateMetric(settings.columns[m], summary));
+    }
+    topProteins.offer(score, position, protein);
+}
+
+// Bytes of input per chunk in parallel mode
+const size_t CHUNK_BYTES = 8 << 20;
+
+// Create a function to rank the records of a stretch of input. Each record's sequence is summarized
+// straight from the raw lines, so it is never copied; `savedHeaders` keeps the headers of ranked
+// records if the reader's views do not last.
+void rankRecords(FastaReader& reader, const RankingSettings& settings, TopList& topProteins,
+                 deque<string>* savedHeaders) {
+    FastaRecord record;
+    RecordSummary summary;
+    while(reader.next(record)) {
+        summarizeRecord(record.lines.data(), record.lines.size(), settings, summary);
+        offerProtein(record.header.data(), record.header.size(), record.offset, summary, settings, topProteins,
+                     savedHeaders);
+    }
+}
+
+// Create a function to rank only the named records or regions, read through the file's .fai index
+// without scanning the rest of the file. Headers made up for regions do not outlive the next fetch,
+// so kept headers are always saved.
+bool rankRegions(IndexedFasta& fasta, const vector<string>& regions, const RankingSettings& settings,
+                 TopList& topProteins, deque<string>& savedHeaders) {
+    FastaRecord record;
+    RecordSummary summary;
+    string error;
+    for(size_t i = 0; i < regions.size(); i++) {
+        if(!fasta.fetch(regions[i], record, error)) {
+            cout << error << "\n";
+            return false;
         }
+        summarizeRecord(record.lines.data(), record.lines.size(), settings, summary);
+        offerProtein(record.header.data(), record.header.size(), record.offset, summary, settings, topProteins,
+                     &savedHeaders);
+    }
+    return true;
+}
+
+// Create a function to rank a whole mapped file on several threads: the file is cut into chunks at
+// record boundaries, workers read their chunks with their own readers and keep their own top lists,
+// and the lists are merged by (score, file position), so the result matches the single-threaded
+// reader. The kept headers are views into the mapping.
+void processFileParallel(const MappedFile& file, unsigned threadCount, const RankingSettings& settings,
+                         TopList& topProteins) {
+    const char* data = file.data;
+    size_t size = file.size;
+    if(size == 0) return;
+
+    // Chunk i holds the records starting in [boundaries[i], boundaries[i + 1])
+    vector<size_t> boundaries(1, 0);
+    for(size_t target = CHUNK_BYTES; target < size; target += CHUNK_BYTES) {
+        size_t boundary = nextFastaRecord(data, size, max(target, boundaries.back() + 1));
+        if(boundary >= size) break;
+        boundaries.push_back(boundary);
+    }
+    boundaries.push_back(size);
+
+    size_t chunkCount = boundaries.size() - 1;
+    vector<TopList> partialTops(threadCount, TopList(topProteins.capacity(), topProteins.minimumScore()));
+    atomic<size_t> nextChunk(0);
+    vector<thread> workers;
+    for(unsigned t = 0; t < threadCount; t++) {
+        workers.push_back(thread([&, t] {
+            FastaReader reader(false);
+            for(size_t chunk = nextChunk++; chunk < chunkCount; chunk = nextChunk++) {
+                reader.attach(data + boundaries[chunk], boundaries[chunk + 1] - boundaries[chunk], boundaries[chunk]);
+                rankRecords(reader, settings, partialTops[t], NULL);
+            }
+        }));
+    }
+    for(unsigned t = 0; t < threadCount; t++) {
+        workers[t].join();
+    }
+
+    for(unsigned t = 0; t < threadCount; t++) {
+        topProteins.merge(partialTops[t]);
     }
 }
 
@@ -43,65 +439,173 @@ void insertIntoTop(ProteinInfo topProteins[], const ProteinInfo& newProtein) {
 int main(int argc, char **argv) {
     // Check command line arguments
     if (argc < 2) {
-        cout << "Use as: " << argv[0] << " <FASTA_file_name>\n";
+        cout << "Use as: " << argv[0] << " <FASTA_file_name> [--rank <metric>] [--metrics <metric,...>]"
+             << " [--window <n> [--scale <file>]] [--top <n>] [--min-score <x>] [--threads <n>]"
+             << " [--regions <file>]\n";
+        cout << "Metrics: " << METRIC_NAMES << " (--metrics also takes all)\n";
         return 0;
     }
-    
-    // Open input file
-    ifstream InFile(argv[1]);
-    if (!InFile.is_open()) {
-        cout << "Cannot open file \"" << argv[1] << "\"\n";
-        return 1;
-    }
 
-    // Initialize array of top proteins
-    ProteinInfo topProteins[16];
-    // Here's where initialization loop goes
-    for(int i = 0; i < 16; i++) {
-        topProteins[i].hydrophobicPercent = -1;
-    }
-
-    string header, sequence, line;
-    
-    // Here's where file reading loop goes
-    while(getline(InFile, line)) {
-        if(line[0] == '>') {  // Found a header
-            if(!sequence.empty()) {  // Process previous sequence if exists
-                if(sequence.length() >= 100) {
-                    ProteinInfo protein;
-                    protein.name = header;
-                    protein.length = sequence.length();
-                    protein.hydrophobicPercent = calculateHydrophobic(sequence);
-                    insertIntoTop(topProteins, protein);
-                }
+    // Read options: the metric to rank by (default: hydrophobic percentage) and the columns to print
+    // (default: the ranking metric alone)
+    RankingSettings settings;
+    parseMetric("hydrophobic", settings.rankMetric);
+    settings.windowed = false;
+    settings.scale.width = 0;
+    bool rankGiven = false;
+    string scaleFile;
+    string regionFile;  // names or name:start-end regions to rank instead of the whole file
+    vector<Metric>& columns = settings.columns;
+    unsigned threadCount = 0;  // 0: read the file line by line on this thread
+    size_t topCount = DEFAULT_TOP_COUNT;
+    double minimumScore = -INFINITY;
+    for(int i = 2; i < argc; i++) {
+        string option = argv[i];
+        if(option == "--rank" && i + 1 < argc) {
+            if(!parseMetric(argv[++i], settings.rankMetric)) {
+                cout << "Unknown metric \"" << argv[i] << "\"; choose from " << METRIC_NAMES << "\n";
+                return 1;
+            }
+            rankGiven = true;
+        }
+        else if(option == "--metrics" && i + 1 < argc) {
+            if(!parseMetricList(argv[++i], columns)) {
+                cout << "Unknown metric in \"" << argv[i] << "\"; choose from " << METRIC_NAMES << ", all\n";
+                return 1;
+            }
+        }
+        else if((option == "--threads" || option == "--window" || option == "--top") && i + 1 < argc) {
+            int value;
+            try {
+                value = stoi(argv[++i]);
+            } catch (...) {
+                value = 0;
+            }
+            if(value <= 0) {
+                cout << (option == "--threads" ? "Number of threads" : option == "--top" ? "Number of proteins"
+                         : "Window size") << " must be a positive integer\n";
+                return 1;
+            }
+            if(option == "--threads") {
+                threadCount = value;
+            }
+            else if(option == "--top") {
+                topCount = value;
             }
-            header = line;
-            sequence.clear();
+            else {
+                settings.windowed = true;
+                settings.scale.width = value;
+            }
+        }
+        else if(option == "--min-score" && i + 1 < argc) {
+            try {
+                minimumScore = stod(argv[++i]);
+            } catch (...) {
+                cout << "Minimum score must be a number\n";
+                return 1;
+            }
+        }
+        else if(option == "--scale" && i + 1 < argc) {
+            scaleFile = argv[++i];
+        }
+        else if(option == "--regions" && i + 1 < argc) {
+            regionFile = argv[++i];
         }
         else {
-            sequence += line;  // Add to current sequence
+            cout << "Unknown option \"" << option << "\"\n";
+            return 1;
+        }
+    }
+
+    // Window mode ranks by the best window of the chosen scale (Kyte-Doolittle unless --scale is given)
+    if(settings.windowed) {
+        if(rankGiven) {
+            cout << "--window ranks by window hydropathy and cannot be combined with --rank\n";
+            return 1;
         }
+        if(scaleFile.empty()) {
+            kyteDoolittleScale(settings.scale);
+        }
+        else if(!readScaleFile(scaleFile, settings.scale)) {
+            cout << "Cannot read scale file \"" << scaleFile << "\"; expected \"<letter> <value>\" lines\n";
+            return 1;
+        }
+        settings.rankMetric.kind = METRIC_WINDOW;
+        settings.rankMetric.residues.clear();
+        settings.rankMetric.column = "MaxHydropathy";
+    }
+    else if(!scaleFile.empty()) {
+        cout << "--scale needs --window\n";
+        return 1;
     }
 
-    // Process the last sequence
-    if(!sequence.empty() && sequence.length() >= 100) {
-        ProteinInfo protein;
-        protein.name = header;
-        protein.length = sequence.length();
-        protein.hydrophobicPercent = calculateHydrophobic(sequence);
-        insertIntoTop(topProteins, protein);
+    // The ranking metric is always printed, first unless --metrics places it elsewhere
+    bool rankPrinted = false;
+    for(size_t m = 0; m < columns.size(); m++) {
+        if(columns[m].column == settings.rankMetric.column) rankPrinted = true;
+    }
+    if(!rankPrinted) {
+        columns.insert(columns.begin(), settings.rankMetric);
+    }
+
+    // Initialize list of top proteins; the file or the saved headers it points into live as long
+    TopList topProteins(topCount, minimumScore);
+    MappedFile file;
+    FastaReader reader(false);
+    IndexedFasta indexed(false);
+    deque<string> savedHeaders;
+
+    // Named records are fetched through the index; there are too few to be worth splitting between threads
+    if(!regionFile.empty()) {
+        vector<string> regions;
+        string error;
+        if(!readRegionList(regionFile, regions)) {
+            cout << "Cannot read file \"" << regionFile << "\"\n";
+            return 1;
+        }
+        if(!indexed.open(argv[1], error)) {
+            cout << error << "\n";
+            return 1;
+        }
+        if(!rankRegions(indexed, regions, settings, topProteins, savedHeaders)) return 1;
+    }
+    // Several threads need the file mapped to split it; a pipe or a gzip file (decompressed in the
+    // background by the reader) is read on this thread instead
+    else if(threadCount > 0 && file.open(argv[1]) && !isGzipData(file.data, file.size)) {
+        processFileParallel(file, threadCount, settings, topProteins);
+    }
+    else {
+        // Open input file
+        if(!reader.open(argv[1])) {
+            cout << "Cannot open file \"" << argv[1] << "\"\n";
+            return 1;
+        }
+        rankRecords(reader, settings, topProteins, reader.viewsStable() ? NULL : &savedHeaders);
+        // Damaged gzip data ends the records early (with a message on stderr); a ranking of part of
+        // the file is not printed
+        if(reader.failed()) return 1;
     }
 
-    // Print results
-    cout << "Rank\t%Hydrophobic\tLength\tProtein\n";
-    for(int i = 0; i < 15; i++) {
-        if(topProteins[i].hydrophobicPercent >= 0) {
-            cout << i + 1 << "\t"
-                 << topProteins[i].hydrophobicPercent << "\t"
-                 << topProteins[i].length << "\t"
-                 << topProteins[i].name.substr(1) << "\n";
+    // Print results; the window column is followed by the window's coordinates
+    cout << "Rank";
+    for(size_t m = 0; m < columns.size(); m++) {
+        cout << "\t" << columns[m].column;
+        if(columns[m].kind == METRIC_WINDOW) cout << "\tSegment";
+    }
+    cout << "\tLength\tProtein\n";
+    vector<TopList::Entry> ranked = topProteins.sorted();
+    for(size_t i = 0; i < ranked.size(); i++) {
+        const ProteinInfo& protein = ranked[i].payload;
+        cout << i + 1 << "\t";
+        for(size_t m = 0; m < columns.size(); m++) {
+            cout << protein.values[m] << "\t";
+            if(columns[m].kind == METRIC_WINDOW) {
+                cout << protein.segmentStart << "-" << protein.segmentEnd << "\t";
+            }
         }
+        cout << protein.length << "\t"
+             << protein.name.substr(1) << "\n";
     }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,267 @@
+// Counting the bases of FASTA text by what they say about G+C content
+//
+// countBases() sorts every byte of a piece of text into G+C (G, C, S), A+T (A, T, U, W), ambiguous
+// (R, Y, M, K, B, D, H, V, N) or other (anything else, line breaks included), in either case.
+//
+// The obvious loop, ++counts[byte], is held back by its own stores: when a base repeats, as it does in
+// every run of N or poly-A, each increment has to wait for the previous one to reach memory. The kernels
+// here avoid that:
+// - on x86-64, vector kernels (SSE2, AVX2, AVX-512BW) fold a whole vector to lower case with OR 0x20,
+//   which turns no other byte into one of the letters looked for, compare it with each code and count
+//   the matches: in per-byte counters emptied with a SAD every 255 vectors (SSE2, AVX2), or with a
+//   popcount of the compare masks (AVX-512);
+// - elsewhere, a scalar kernel spreads consecutive bytes over four 256-entry tables, so a repeated base
+//   updates four different counters, and adds the tables up at the end.
+//
+// The fastest kernel the CPU supports is picked at run time, once, so programs are built without -mavx2
+// and still run on any x86-64 machine. baseCountKernels() lists them all, for benchmarks and tests.
+
+#ifndef BIOINFORMATICS_COMMON_BASE_COUNTS_H
+#define BIOINFORMATICS_COMMON_BASE_COUNTS_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define BASE_COUNTS_X86 1
+#include <immintrin.h>
+#endif
+
+// Bases of a sequence by what they say about G+C content, counted as in the GC programs
+struct BaseCounts {
+    uint64_t gc;         // G, C and S
+    uint64_t at;         // A, T, U and W
+    uint64_t ambiguous;  // R, Y, M, K, B, D, H, V and N
+    uint64_t other;      // anything else (gaps, stops, digits), not counted as nucleotides
+
+    uint64_t length() const { return gc + at + ambiguous; }
+};
+
+// The class of every byte value (0 G+C, 1 A+T, 2 ambiguous, 3 other), built once (thread-safely, being a
+// function-local static)
+struct BaseClassTable {
+    unsigned char of[256];
+
+    BaseClassTable() {
+        memset(of, 3, sizeof(of));
+        const char* codes[3] = {"gcs", "atuw", "rymkbdhvn"};
+        for (int type = 0; type < 3; type++) {
+            for (const char* c = codes[type]; *c != 0; c++) {
+                of[(unsigned char)*c] = type;
+                of[(unsigned char)*c - 32] = type;  // upper case
+            }
+        }
+    }
+};
+
+inline const BaseClassTable& baseClasses() {
+    static const BaseClassTable table;
+    return table;
+}
+
+// Count a short piece of text one byte at a time (used for the ends the vector kernels leave over)
+inline void addBaseCountsByByte(const char* text, size_t size, BaseCounts& counts) {
+    const unsigned char* classes = baseClasses().of;
+    uint64_t byClass[4] = {0, 0, 0, 0};
+    for (size_t i = 0; i < size; i++) byClass[classes[(unsigned char)text[i]]]++;
+    counts.gc += byClass[0];
+    counts.at += byClass[1];
+    counts.ambiguous += byClass[2];
+    counts.other += byClass[3];
+}
+
+// Portable kernel: four interleaved histograms, added up by class at the end
+inline BaseCounts countBasesScalar(const char* text, size_t size) {
+    BaseCounts counts = {0, 0, 0, 0};
+    if (size < 1024) {  // not worth clearing 8 KB of tables for
+        addBaseCountsByByte(text, size, counts);
+        return counts;
+    }
+    const unsigned char* bytes = (const unsigned char*)text;
+    uint64_t tables[4][256] = {};
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        tables[0][bytes[i]]++;
+        tables[1][bytes[i + 1]]++;
+        tables[2][bytes[i + 2]]++;
+        tables[3][bytes[i + 3]]++;
+    }
+    for (; i < size; i++) tables[0][bytes[i]]++;
+    const unsigned char* classes = baseClasses().of;
+    uint64_t byClass[4] = {0, 0, 0, 0};
+    for (int value = 0; value < 256; value++) {
+        byClass[classes[value]] += tables[0][value] + tables[1][value] + tables[2][value] + tables[3][value];
+    }
+    counts.gc = byClass[0];
+    counts.at = byClass[1];
+    counts.ambiguous = byClass[2];
+    counts.other = byClass[3];
+    return counts;
+}
+
+#ifdef BASE_COUNTS_X86
+
+// SSE2 (every x86-64 CPU): 16 bytes at a time
+__attribute__((target("sse2"))) inline BaseCounts countBasesSse2(const char* text, size_t size) {
+    const __m128i lower = _mm_set1_epi8(0x20);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i g = _mm_set1_epi8('g'), c = _mm_set1_epi8('c'), s = _mm_set1_epi8('s');
+    const __m128i a = _mm_set1_epi8('a'), t = _mm_set1_epi8('t'), u = _mm_set1_epi8('u'), w = _mm_set1_epi8('w');
+    const __m128i r = _mm_set1_epi8('r'), y = _mm_set1_epi8('y'), m = _mm_set1_epi8('m'), k = _mm_set1_epi8('k');
+    const __m128i b = _mm_set1_epi8('b'), d = _mm_set1_epi8('d'), h = _mm_set1_epi8('h'), v = _mm_set1_epi8('v');
+    const __m128i n = _mm_set1_epi8('n');
+    __m128i gcTotal = zero, atTotal = zero, ambiguousTotal = zero;  // two 64-bit sums each
+    size_t i = 0;
+    while (size - i >= 16) {
+        // A compare gives -1 in each matching byte, so subtracting it counts the match; a byte counter
+        // holds up to 255, so the counters are added to the totals every 255 vectors
+        size_t blockEnd = i + 16 * std::min<size_t>(255, (size - i) / 16);
+        __m128i gc = zero, at = zero, ambiguous = zero;
+        for (; i < blockEnd; i += 16) {
+            __m128i x = _mm_or_si128(_mm_loadu_si128((const __m128i*)(text + i)), lower);
+            gc = _mm_sub_epi8(gc, _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, g), _mm_cmpeq_epi8(x, c)),
+                                               _mm_cmpeq_epi8(x, s)));
+            at = _mm_sub_epi8(at, _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, a), _mm_cmpeq_epi8(x, t)),
+                                               _mm_or_si128(_mm_cmpeq_epi8(x, u), _mm_cmpeq_epi8(x, w))));
+            __m128i any = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, r), _mm_cmpeq_epi8(x, y)),
+                                       _mm_or_si128(_mm_cmpeq_epi8(x, m), _mm_cmpeq_epi8(x, k)));
+            any = _mm_or_si128(any, _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, b), _mm_cmpeq_epi8(x, d)),
+                                                 _mm_or_si128(_mm_cmpeq_epi8(x, h), _mm_cmpeq_epi8(x, v))));
+            ambiguous = _mm_sub_epi8(ambiguous, _mm_or_si128(any, _mm_cmpeq_epi8(x, n)));
+        }
+        gcTotal = _mm_add_epi64(gcTotal, _mm_sad_epu8(gc, zero));
+        atTotal = _mm_add_epi64(atTotal, _mm_sad_epu8(at, zero));
+        ambiguousTotal = _mm_add_epi64(ambiguousTotal, _mm_sad_epu8(ambiguous, zero));
+    }
+    uint64_t lanes[3][2];
+    _mm_storeu_si128((__m128i*)lanes[0], gcTotal);
+    _mm_storeu_si128((__m128i*)lanes[1], atTotal);
+    _mm_storeu_si128((__m128i*)lanes[2], ambiguousTotal);
+    BaseCounts counts = {lanes[0][0] + lanes[0][1], lanes[1][0] + lanes[1][1], lanes[2][0] + lanes[2][1], 0};
+    counts.other = i - counts.length();
+    addBaseCountsByByte(text + i, size - i, counts);
+    return counts;
+}
+
+// AVX2: the same as SSE2, 32 bytes at a time
+__attribute__((target("avx2"))) inline BaseCounts countBasesAvx2(const char* text, size_t size) {
+    const __m256i lower = _mm256_set1_epi8(0x20);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i g = _mm256_set1_epi8('g'), c = _mm256_set1_epi8('c'), s = _mm256_set1_epi8('s');
+    const __m256i a = _mm256_set1_epi8('a'), t = _mm256_set1_epi8('t'), u = _mm256_set1_epi8('u');
+    const __m256i w = _mm256_set1_epi8('w'), r = _mm256_set1_epi8('r'), y = _mm256_set1_epi8('y');
+    const __m256i m = _mm256_set1_epi8('m'), k = _mm256_set1_epi8('k'), b = _mm256_set1_epi8('b');
+    const __m256i d = _mm256_set1_epi8('d'), h = _mm256_set1_epi8('h'), v = _mm256_set1_epi8('v');
+    const __m256i n = _mm256_set1_epi8('n');
+    __m256i gcTotal = zero, atTotal = zero, ambiguousTotal = zero;  // four 64-bit sums each
+    size_t i = 0;
+    while (size - i >= 32) {
+        size_t blockEnd = i + 32 * std::min<size_t>(255, (size - i) / 32);
+        __m256i gc = zero, at = zero, ambiguous = zero;
+        for (; i < blockEnd; i += 32) {
+            __m256i x = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(text + i)), lower);
+            gc = _mm256_sub_epi8(gc, _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(x, g), _mm256_cmpeq_epi8(x, c)),
+                                                     _mm256_cmpeq_epi8(x, s)));
+            at = _mm256_sub_epi8(at, _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(x, a), _mm256_cmpeq_epi8(x, t)),
+                                                     _mm256_or_si256(_mm256_cmpeq_epi8(x, u), _mm256_cmpeq_epi8(x, w))));
+            __m256i any = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(x, r), _mm256_cmpeq_epi8(x, y)),
+                                          _mm256_or_si256(_mm256_cmpeq_epi8(x, m), _mm256_cmpeq_epi8(x, k)));
+            any = _mm256_or_si256(any, _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(x, b), _mm256_cmpeq_epi8(x, d)),
+                                                       _mm256_or_si256(_mm256_cmpeq_epi8(x, h), _mm256_cmpeq_epi8(x, v))));
+            ambiguous = _mm256_sub_epi8(ambiguous, _mm256_or_si256(any, _mm256_cmpeq_epi8(x, n)));
+        }
+        gcTotal = _mm256_add_epi64(gcTotal, _mm256_sad_epu8(gc, zero));
+        atTotal = _mm256_add_epi64(atTotal, _mm256_sad_epu8(at, zero));
+        ambiguousTotal = _mm256_add_epi64(ambiguousTotal, _mm256_sad_epu8(ambiguous, zero));
+    }
+    uint64_t lanes[3][4];
+    _mm256_storeu_si256((__m256i*)lanes[0], gcTotal);
+    _mm256_storeu_si256((__m256i*)lanes[1], atTotal);
+    _mm256_storeu_si256((__m256i*)lanes[2], ambiguousTotal);
+    BaseCounts counts = {0, 0, 0, 0};
+    for (int lane = 0; lane < 4; lane++) {
+        counts.gc += lanes[0][lane];
+        counts.at += lanes[1][lane];
+        counts.ambiguous += lanes[2][lane];
+    }
+    counts.other = i - counts.length();
+    addBaseCountsByByte(text + i, size - i, counts);
+    return counts;
+}
+
+// AVX-512BW: 64 bytes at a time, each compare giving a 64-bit mask that is counted with popcount. The
+// last bytes are read with a masked load, which fills the rest of the vector with zeros; these read
+// as spaces after OR 0x20 and so match no code.
+__attribute__((target("avx512bw,popcnt"))) inline BaseCounts countBasesAvx512(const char* text, size_t size) {
+    const __m512i lower = _mm512_set1_epi8(0x20);
+    const __m512i g = _mm512_set1_epi8('g'), c = _mm512_set1_epi8('c'), s = _mm512_set1_epi8('s');
+    const __m512i a = _mm512_set1_epi8('a'), t = _mm512_set1_epi8('t'), u = _mm512_set1_epi8('u');
+    const __m512i w = _mm512_set1_epi8('w'), r = _mm512_set1_epi8('r'), y = _mm512_set1_epi8('y');
+    const __m512i m = _mm512_set1_epi8('m'), k = _mm512_set1_epi8('k'), b = _mm512_set1_epi8('b');
+    const __m512i d = _mm512_set1_epi8('d'), h = _mm512_set1_epi8('h'), v = _mm512_set1_epi8('v');
+    const __m512i n = _mm512_set1_epi8('n');
+    BaseCounts counts = {0, 0, 0, 0};
+    for (size_t i = 0; i < size; i += 64) {
+        __m512i x = size - i >= 64 ? _mm512_loadu_si512(text + i)
+                                   : _mm512_maskz_loadu_epi8(~0ULL >> (64 - (size - i)), text + i);
+        x = _mm512_or_si512(x, lower);
+        __mmask64 gc = _mm512_cmpeq_epi8_mask(x, g) | _mm512_cmpeq_epi8_mask(x, c) | _mm512_cmpeq_epi8_mask(x, s);
+        __mmask64 at = _mm512_cmpeq_epi8_mask(x, a) | _mm512_cmpeq_epi8_mask(x, t) | _mm512_cmpeq_epi8_mask(x, u)
+                       | _mm512_cmpeq_epi8_mask(x, w);
+        __mmask64 ambiguous = _mm512_cmpeq_epi8_mask(x, r) | _mm512_cmpeq_epi8_mask(x, y)
+                              | _mm512_cmpeq_epi8_mask(x, m) | _mm512_cmpeq_epi8_mask(x, k)
+                              | _mm512_cmpeq_epi8_mask(x, b) | _mm512_cmpeq_epi8_mask(x, d)
+                              | _mm512_cmpeq_epi8_mask(x, h) | _mm512_cmpeq_epi8_mask(x, v)
+                              | _mm512_cmpeq_epi8_mask(x, n);
+        counts.gc += __builtin_popcountll(gc);
+        counts.at += __builtin_popcountll(at);
+        counts.ambiguous += __builtin_popcountll(ambiguous);
+    }
+    counts.other = size - counts.length();
+    return counts;
+}
+
+#endif
+
+typedef BaseCounts (*BaseCountFunction)(const char* text, size_t size);
+
+struct BaseCountKernel {
+    const char* name;
+    BaseCountFunction count;
+};
+
+// The kernels this CPU can run, the portable one first and the fastest last
+inline std::vector<BaseCountKernel> baseCountKernels() {
+    std::vector<BaseCountKernel> kernels;
+    kernels.push_back(BaseCountKernel{"scalar", countBasesScalar});
+#ifdef BASE_COUNTS_X86
+    __builtin_cpu_init();
+    kernels.push_back(BaseCountKernel{"sse2", countBasesSse2});
+    if (__builtin_cpu_supports("avx2")) kernels.push_back(BaseCountKernel{"avx2", countBasesAvx2});
+    if (__builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("popcnt")) {
+        kernels.push_back(BaseCountKernel{"avx512", countBasesAvx512});
+    }
+#endif
+    return kernels;
+}
+
+// The kernel countBases() uses
+inline const BaseCountKernel& bestBaseCountKernel() {
+    static const BaseCountKernel best = baseCountKernels().back();
+    return best;
+}
+
+// Count the bases of a piece of FASTA text with the fastest kernel the CPU supports
+inline BaseCounts countBases(const char* text, size_t size) {
+    return bestBaseCountKernel().count(text, size);
+}
+
+inline BaseCounts countBases(std::string_view text) {
+    return countBases(text.data(), text.size());
+}
+
+#endif
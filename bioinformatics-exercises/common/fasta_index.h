@@ -0,0 +1,325 @@
+// Random access to the records of a FASTA file through a samtools-compatible .fai index
+//
+// A .fai file has one tab-separated line per record: name (the header up to the first whitespace),
+// sequence length, byte offset of the sequence, bases per line and bytes per line. Because every line
+// of a record but the last holds the same number of bases, the byte holding any base can be computed,
+// so a record or a region of one is read without scanning the file. IndexedFasta maps the FASTA, loads
+// "<file>.fai" (building and saving it first if it is missing, older than the FASTA or does not fit it)
+// and hands out records and regions as FastaRecords, like FastaReader.
+//
+// Regions are written as in samtools: "name" for a whole record, "name:start-end" or "name:start" for
+// part of one, with 1-based inclusive coordinates (commas allowed in numbers); an end beyond the record
+// is clipped to it.
+
+#ifndef BIOINFORMATICS_COMMON_FASTA_INDEX_H
+#define BIOINFORMATICS_COMMON_FASTA_INDEX_H
+
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "fasta_reader.h"
+#include "gzip_input.h"
+
+// One line of a .fai file
+struct FaiEntry {
+    std::string name;
+    uint64_t length;     // bases in the sequence
+    uint64_t offset;     // byte offset of the first base
+    uint64_t lineBases;  // bases per full line
+    uint64_t lineWidth;  // bytes per full line, line break included
+};
+
+class FastaIndex {
+public:
+    // Index a FASTA held in memory; false with a message in `error` if a record's lines are uneven
+    bool build(const char* data, size_t size, std::string& error) {
+        entries.clear();
+        FaiEntry* entry = NULL;
+        bool ended = false;  // the current record had a short or blank line, so it must end here
+        for (size_t position = 0; position < size;) {
+            const char* newline = (const char*)memchr(data + position, '\n', size - position);
+            size_t next = newline == NULL ? size : newline - data + 1;
+            size_t bases = (newline == NULL ? size : newline - data) - position;
+            if (bases > 0 && data[position + bases - 1] == '\r') bases--;
+
+            if (data[position] == '>') {
+                size_t nameEnd = position + 1;
+                while (nameEnd < position + bases && !isspace((unsigned char)data[nameEnd])) nameEnd++;
+                FaiEntry added = {std::string(data + position + 1, nameEnd - position - 1), 0, next, 0, 0};
+                entries.push_back(added);
+                entry = &entries.back();
+                ended = false;
+            } else if (bases == 0) {
+                ended = entry != NULL && entry->length > 0;  // blank lines before the sequence are skipped
+            } else if (entry == NULL) {
+                error = "the file does not start with a FASTA header";
+                return false;
+            } else {
+                if (entry->lineBases == 0) {
+                    entry->offset = position;
+                    entry->lineBases = bases;
+                    entry->lineWidth = next - position;
+                } else if (ended || bases > entry->lineBases
+                           || (newline != NULL && next - position - bases != entry->lineWidth - entry->lineBases)) {
+                    error = "lines of record \"" + entry->name + "\" differ in length";
+                    return false;
+                }
+                if (bases < entry->lineBases) ended = true;
+                entry->length += bases;
+            }
+            position = next;
+        }
+        mapNames();
+        return true;
+    }
+
+    // Read a .fai file; false if it cannot be read or is malformed
+    bool read(const std::string& filename) {
+        entries.clear();
+        std::ifstream file(filename.c_str());
+        if (!file.is_open()) return false;
+        std::string line;
+        while (getline(file, line)) {
+            std::istringstream fields(line);
+            FaiEntry entry;
+            if (!getline(fields, entry.name, '\t')
+                || !(fields >> entry.length >> entry.offset >> entry.lineBases >> entry.lineWidth)) {
+                entries.clear();
+                return false;
+            }
+            entries.push_back(entry);
+        }
+        mapNames();
+        return true;
+    }
+
+    // Write the index in .fai format, through a temporary file so a reader never sees half of it
+    bool write(const std::string& filename) const {
+        std::string temporary = filename + ".tmp" + std::to_string(getpid());
+        {
+            std::ofstream file(temporary.c_str());
+            for (size_t i = 0; i < entries.size(); i++) {
+                const FaiEntry& entry = entries[i];
+                file << entry.name << '\t' << entry.length << '\t' << entry.offset << '\t' << entry.lineBases
+                     << '\t' << entry.lineWidth << '\n';
+            }
+            if (!file.flush()) {
+                std::remove(temporary.c_str());
+                return false;
+            }
+        }
+        return std::rename(temporary.c_str(), filename.c_str()) == 0;
+    }
+
+    // Use entries made elsewhere, e.g. names and lengths of sequences held in memory, so regions of
+    // them can be resolved with parseRegion()
+    void assign(const std::vector<FaiEntry>& list) {
+        entries = list;
+        mapNames();
+    }
+
+    // True if every record lies within a file of `size` bytes
+    bool fits(uint64_t size) const {
+        for (size_t i = 0; i < entries.size(); i++) {
+            const FaiEntry& entry = entries[i];
+            if (entry.length > 0 && (entry.lineBases == 0 || entry.lineWidth < entry.lineBases
+                                     || byteOffset(entry, entry.length - 1) >= size)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // The record called `name`, or NULL; with duplicate names the first record wins, as in samtools
+    const FaiEntry* find(std::string_view name) const {
+        std::unordered_map<std::string_view, size_t>::const_iterator found = byName.find(name);
+        return found == byName.end() ? NULL : &entries[found->second];
+    }
+
+    const std::vector<FaiEntry>& records() const { return entries; }
+
+    // Byte offset of base `position` (0-based) of a record
+    static uint64_t byteOffset(const FaiEntry& entry, uint64_t position) {
+        return entry.offset + position / entry.lineBases * entry.lineWidth + position % entry.lineBases;
+    }
+
+private:
+    void mapNames() {
+        byName.clear();
+        byName.reserve(entries.size());
+        for (size_t i = 0; i < entries.size(); i++) {
+            byName.emplace(std::string_view(entries[i].name), i);
+        }
+    }
+
+    std::vector<FaiEntry> entries;
+    std::unordered_map<std::string_view, size_t> byName;  // views of the names in `entries`
+};
+
+// A whole record or part of one: bases [start, end), 0-based
+struct FastaRegion {
+    const FaiEntry* entry;
+    uint64_t start;
+    uint64_t end;
+    bool whole;
+};
+
+// Parse a 1-based, comma-tolerant coordinate; false unless it is a positive number
+inline bool parseCoordinate(const std::string& text, uint64_t& value) {
+    value = 0;
+    bool digits = false;
+    for (size_t i = 0; i < text.size(); i++) {
+        if (text[i] == ',') continue;
+        if (text[i] < '0' || text[i] > '9' || value > UINT64_MAX / 10 - 1) return false;
+        value = value * 10 + (text[i] - '0');
+        digits = true;
+    }
+    return digits && value > 0;
+}
+
+// Resolve "name", "name:start" or "name:start-end" against an index. A name that itself contains
+// ':' is matched whole first, as samtools does.
+inline bool parseRegion(const FastaIndex& index, const std::string& text, FastaRegion& region, std::string& error) {
+    region.entry = index.find(text);
+    if (region.entry != NULL) {
+        region.start = 0;
+        region.end = region.entry->length;
+        region.whole = true;
+        return true;
+    }
+    size_t colon = text.rfind(':');
+    if (colon == std::string::npos || (region.entry = index.find(std::string_view(text).substr(0, colon))) == NULL) {
+        error = "Unknown sequence name \"" + text + "\"";
+        return false;
+    }
+    std::string range = text.substr(colon + 1);
+    size_t dash = range.find('-');
+    uint64_t first, last = region.entry->length;
+    if (!parseCoordinate(range.substr(0, dash), first)
+        || (dash != std::string::npos && dash + 1 < range.size() && !parseCoordinate(range.substr(dash + 1), last))
+        || first > last || first > region.entry->length) {
+        error = "Invalid region \"" + text + "\" (" + region.entry->name + " has "
+                + std::to_string(region.entry->length) + " bases)";
+        return false;
+    }
+    region.start = first - 1;
+    region.end = std::min(last, region.entry->length);
+    region.whole = false;
+    return true;
+}
+
+// Read a list of record names or regions: the first word of each line; blank lines and lines
+// starting with '#' are skipped; false if the file cannot be opened or is damaged gzip data
+inline bool readRegionList(const std::string& filename, std::vector<std::string>& regions) {
+    InputFile file(filename);
+    if (!file.is_open()) return false;
+    std::string line;
+    while (getline(file, line)) {
+        std::istringstream fields(line);
+        std::string region;
+        if (fields >> region && region[0] != '#') regions.push_back(region);
+    }
+    return !file.failed();
+}
+
+class IndexedFasta {
+public:
+    // With `joinLines` false only header, lines and offset are filled in, as with FastaReader
+    explicit IndexedFasta(bool joinLines = true) : join(joinLines) {}
+    IndexedFasta(const IndexedFasta&) = delete;
+    IndexedFasta& operator=(const IndexedFasta&) = delete;
+
+    // Map a FASTA file and load its index, building and saving it if needed (if the index cannot be
+    // saved, e.g. in a read-only directory, it is kept in memory only)
+    bool open(const std::string& filename, std::string& error) {
+        if (!mapped.open(filename.c_str())) {
+            error = "Cannot open file \"" + filename + "\"";
+            return false;
+        }
+        if (isGzipData(mapped.data, mapped.size)) {
+            error = "\"" + filename + "\" is compressed; reading records by name needs an uncompressed FASTA file";
+            return false;
+        }
+        std::string faiFile = filename + ".fai";
+        struct stat fastaStatus, faiStatus;
+        bool current = stat(filename.c_str(), &fastaStatus) == 0 && stat(faiFile.c_str(), &faiStatus) == 0
+                       && faiStatus.st_mtime >= fastaStatus.st_mtime;
+        if (current && fai.read(faiFile) && fai.fits(mapped.size)) return true;
+        if (!fai.build(mapped.data, mapped.size, error)) {
+            error = "Cannot index \"" + filename + "\": " + error;
+            return false;
+        }
+        fai.write(faiFile);
+        return true;
+    }
+
+    const FastaIndex& index() const { return fai; }
+
+    // Fetch a record or region given as text; false with a message in `error` if it is not in the index
+    bool fetch(const std::string& text, FastaRecord& record, std::string& error) {
+        FastaRegion region;
+        if (!parseRegion(fai, text, region, error)) return false;
+        fetch(region, record);
+        return true;
+    }
+
+    // Fetch a record or region. A whole record keeps its own header line; a part of one is headed
+    // ">name:start-end". Views stay valid until the next fetch (header and lines of whole records, which
+    // point into the mapping, for as long as the IndexedFasta).
+    void fetch(const FastaRegion& region, FastaRecord& record) {
+        const FaiEntry& entry = *region.entry;
+        uint64_t begin = entry.offset, end = entry.offset;
+        if (region.end > region.start) {
+            begin = FastaIndex::byteOffset(entry, region.start);
+            end = FastaIndex::byteOffset(entry, region.end - 1) + 1;
+        }
+        if (region.whole) {
+            record.header = headerLine(entry);
+        } else {
+            regionHeader = ">" + entry.name + ":" + std::to_string(region.start + 1) + "-" + std::to_string(region.end);
+            record.header = regionHeader;
+        }
+        record.lines = std::string_view(mapped.data + begin, end - begin);
+        record.sequence = join ? joinLines(record.lines) : std::string_view();
+        record.offset = begin;
+    }
+
+private:
+    // The header line of a record, ending just before its sequence
+    std::string_view headerLine(const FaiEntry& entry) const {
+        size_t end = entry.offset;
+        while (end > 0 && isspace((unsigned char)mapped.data[end - 1])) end--;
+        size_t start = end;
+        while (start > 0 && mapped.data[start - 1] != '\n') start--;
+        return std::string_view(mapped.data + start, end - start);
+    }
+
+    // The bases of a span of lines, a view if it has no line breaks, otherwise copied into `joined`
+    std::string_view joinLines(std::string_view lines) {
+        if (memchr(lines.data(), '\n', lines.size()) == NULL) return lines;
+        joined.clear();
+        for (size_t i = 0; i < lines.size(); i++) {
+            if (lines[i] != '\n' && lines[i] != '\r') joined += lines[i];
+        }
+        return joined;
+    }
+
+    bool join;
+    MappedFile mapped;
+    FastaIndex fai;
+    std::string regionHeader;  // the header made up for the last region
+    std::string joined;        // the last multi-line sequence, line breaks removed
+};
+
+#endif
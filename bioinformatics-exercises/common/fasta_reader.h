@@ -0,0 +1,265 @@
+// Shared FASTA reader for the tools in this repository
+//
+// FastaReader yields one record at a time as views rather than strings. A file is memory-mapped when
+// it can be, so headers and raw sequence lines point straight into the mapping; anything else (a pipe,
+// a gzip or BGZF file, which is decompressed on the fly, or an attached istream) is read in large
+// blocks into a buffer. Records are found with memchr over
+// whole blocks, never line by line, and a sequence is only copied, into a buffer reused from record
+// to record, when it spans several lines and its line breaks have to be removed.
+//
+// Rules: a record starts at a '>' that begins a line. Its header is that line, '>' included, without
+// trailing whitespace. Sequence lines are trimmed of spaces, tabs and carriage returns at both ends,
+// so CRLF files read like LF files, and blank lines are skipped. Anything but blank lines before the
+// first header is returned as a record with an empty header; a header with no sequence is returned
+// with an empty one.
+
+#ifndef BIOINFORMATICS_COMMON_FASTA_READER_H
+#define BIOINFORMATICS_COMMON_FASTA_READER_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "gzip_input.h"
+
+// A read-only memory mapping of a whole regular file, unmapped when it goes out of scope
+struct MappedFile {
+    const char* data;
+    size_t size;
+
+    MappedFile() : data(NULL), size(0) {}
+    ~MappedFile() { close(); }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Map a file for one sequential pass; false if it cannot be opened or is not a regular file.
+    // An empty file maps to no data.
+    bool open(const char* filename) {
+        close();
+        int fd = ::open(filename, O_RDONLY);
+        struct stat status;
+        if (fd < 0 || fstat(fd, &status) != 0 || !S_ISREG(status.st_mode)) {
+            if (fd >= 0) ::close(fd);
+            return false;
+        }
+        if (status.st_size == 0) {
+            ::close(fd);
+            return true;
+        }
+        void* mapping = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED) return false;
+        madvise(mapping, status.st_size, MADV_SEQUENTIAL);
+        data = (const char*)mapping;
+        size = status.st_size;
+        return true;
+    }
+
+    void close() {
+        if (size > 0) munmap((void*)data, size);
+        data = NULL;
+        size = 0;
+    }
+};
+
+// Start of the record containing or following `position`: the next '>' at the beginning of a line,
+// or `size`. Cuts a mapped file into chunks of whole records for parallel readers.
+inline size_t nextFastaRecord(const char* data, size_t size, size_t position) {
+    while (position < size) {
+        const char* marker = (const char*)memchr(data + position, '>', size - position);
+        if (marker == NULL) return size;
+        position = marker - data;
+        if (position == 0 || data[position - 1] == '\n') return position;
+        position++;
+    }
+    return size;
+}
+
+// One record. The views stay valid until the next call to FastaReader::next; when the reader's
+// viewsStable() is true, header and lines stay valid for as long as the reader (or the attached
+// memory) itself.
+struct FastaRecord {
+    std::string_view header;    // header line including its '>'; empty for data before the first header
+    std::string_view lines;     // the sequence exactly as in the input, line breaks included
+    std::string_view sequence;  // the sequence with line breaks and surrounding whitespace removed
+    uint64_t offset;            // byte offset of the record in the input
+};
+
+class FastaReader {
+public:
+    // With `joinLines` false only header, lines and offset are filled in, for callers that can scan
+    // the raw lines themselves and want no copy at all
+    explicit FastaReader(bool joinLines = true)
+        : join(joinLines), input(NULL), data(NULL), position(0), end(0), base(0) {}
+    FastaReader(const FastaReader&) = delete;
+    FastaReader& operator=(const FastaReader&) = delete;
+
+    // Read a file: mapped if it is a regular file, otherwise streamed in blocks (decompressing it if
+    // it is gzip data)
+    bool open(const std::string& filename) {
+        reset();
+        if (mapped.open(filename.c_str())) {
+            if (!isGzipData(mapped.data, mapped.size)) {
+                data = mapped.data;
+                end = mapped.size;
+                return true;
+            }
+            mapped.close();
+        }
+        file.clear();
+        if (!file.open(filename)) return false;
+        input = &file;
+        return true;
+    }
+
+    // Read records from an open stream, in blocks
+    void attach(std::istream& stream) {
+        reset();
+        input = &stream;
+    }
+
+    // Read records from memory, e.g. a chunk of a mapped file; offsets count from `offset`
+    void attach(const char* memory, size_t size, uint64_t offset = 0) {
+        reset();
+        data = memory;
+        end = size;
+        base = offset;
+    }
+
+    // True if the input is in memory (mapped or attached), so headers and lines outlive next()
+    bool viewsStable() const { return input == NULL; }
+
+    // True if the stream being read broke off: a read error, or gzip data that turned out to be
+    // corrupt or truncated. next() has then returned false early, at what looked like the end.
+    bool failed() const {
+        if (input == NULL) return false;
+        const InputFile* source = dynamic_cast<const InputFile*>(input);
+        return input->bad() || (source != NULL && source->failed());
+    }
+
+    // Read the next record; returns false at end of input (check failed() then)
+    bool next(FastaRecord& record) {
+        size_t length;
+        for (;;) {
+            if (position == end && !fill()) return false;
+
+            // The record runs to the next header; a stream may need more blocks to find it
+            size_t searched = 1;
+            for (;;) {
+                length = nextFastaRecord(data + position, end - position, searched);
+                if (length < end - position) break;
+                searched = length;
+                if (!fill()) break;
+            }
+            if (data[position] == '>' || !isBlank(data + position, length)) break;
+            position += length;  // blank lines before the first header
+        }
+
+        const char* start = data + position;
+        size_t sequenceStart = 0;
+        record.header = std::string_view();
+        if (start[0] == '>') {
+            const char* newline = (const char*)memchr(start, '\n', length);
+            size_t headerEnd = newline == NULL ? length : newline - start;
+            sequenceStart = newline == NULL ? length : headerEnd + 1;
+            while (headerEnd > 1 && isSpace(start[headerEnd - 1])) headerEnd--;
+            record.header = std::string_view(start, headerEnd);
+        }
+        record.lines = std::string_view(start + sequenceStart, length - sequenceStart);
+        record.sequence = join ? joinLines(record.lines) : std::string_view();
+        record.offset = base + position;
+        position += length;
+        return true;
+    }
+
+private:
+    // Bytes read from a stream at a time; the buffer grows beyond this only for longer records
+    static const size_t BLOCK_SIZE = 4 << 20;
+
+    static bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+    static bool isBlank(const char* text, size_t length) {
+        for (size_t i = 0; i < length; i++) {
+            if (!isSpace(text[i]) && text[i] != '\n') return false;
+        }
+        return true;
+    }
+
+    // A line without the whitespace around it
+    static std::string_view trimLine(const char* line, size_t length) {
+        size_t begin = 0;
+        while (begin < length && isSpace(line[begin])) begin++;
+        while (length > begin && isSpace(line[length - 1])) length--;
+        return std::string_view(line + begin, length - begin);
+    }
+
+    // The sequence without line breaks: a view of the input if it is a single line, otherwise the
+    // trimmed lines copied into `joined`
+    std::string_view joinLines(std::string_view lines) {
+        const char* text = lines.data();
+        size_t size = lines.size();
+        const char* newline = (const char*)memchr(text, '\n', size);
+        if (newline == NULL || newline == text + size - 1) {
+            return trimLine(text, newline == NULL ? size : size - 1);
+        }
+        joined.clear();
+        size_t lineStart = 0;
+        while (lineStart < size) {
+            newline = (const char*)memchr(text + lineStart, '\n', size - lineStart);
+            size_t lineEnd = newline == NULL ? size : newline - text;
+            std::string_view line = trimLine(text + lineStart, lineEnd - lineStart);
+            joined.append(line.data(), line.size());
+            lineStart = lineEnd + 1;
+        }
+        return joined;
+    }
+
+    // Append the next block of a stream to the unread data, moving that to the front of the buffer
+    // first; false at end of input (always, for memory)
+    bool fill() {
+        if (input == NULL) return false;
+        if (position > 0) {
+            memmove(buffer.data(), buffer.data() + position, end - position);
+            base += position;
+            end -= position;
+            position = 0;
+        }
+        if (buffer.size() - end < BLOCK_SIZE) {
+            buffer.resize(std::max(buffer.size() * 2, end + BLOCK_SIZE));
+        }
+        input->read(buffer.data() + end, buffer.size() - end);
+        size_t count = input->gcount();
+        end += count;
+        data = buffer.data();
+        return count > 0;
+    }
+
+    void reset() {
+        mapped.close();
+        input = NULL;
+        data = NULL;
+        position = end = 0;
+        base = 0;
+    }
+
+    bool join;
+    MappedFile mapped;
+    InputFile file;
+    std::istream* input;      // stream being read in blocks; NULL when the input is in memory
+    std::vector<char> buffer; // stream blocks
+    const char* data;         // the input in memory, or `buffer`
+    size_t position;          // start of the unread input in `data`
+    size_t end;
+    uint64_t base;            // input offset of data[0]
+    std::string joined;       // the last multi-line sequence, line breaks removed
+};
+
+#endif
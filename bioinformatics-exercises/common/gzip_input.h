@@ -0,0 +1,385 @@
+// Transparent gzip and BGZF input for the tools in this repository
+//
+// InputFile is an istream that reads a plain file as it is and a gzip file decompressed, recognising
+// the format by its first bytes (so pipes work too). Decompression runs in the background, overlapping
+// with whatever the tool does with the data:
+// - BGZF files (bgzip, samtools) are series of independent deflate blocks of at most 64 KB. Batches of
+//   blocks are inflated on a pool of worker threads and handed out in file order.
+// - Any other gzip file, including concatenated members, is inflated as one stream on its own thread.
+// Data that is corrupt or cut short ends the stream early with an error on stderr, and failed() turns
+// true; a tool must check it before treating what it read as the whole file.
+//
+// Programs that include this header link with zlib and threads: g++ ... -pthread -lz
+
+#ifndef BIOINFORMATICS_COMMON_GZIP_INPUT_H
+#define BIOINFORMATICS_COMMON_GZIP_INPUT_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+#include <zlib.h>
+
+// True if data starts like a gzip member
+inline bool isGzipData(const char* data, size_t size) {
+    return size >= 2 && (unsigned char)data[0] == 0x1f && (unsigned char)data[1] == 0x8b;
+}
+
+// Length of the BGZF block whose header starts at `header`, or 0 if it is not a BGZF block header:
+// a gzip member header with an extra field holding the "BC" subfield, which stores the block size
+inline size_t bgzfBlockSize(const unsigned char* header, size_t size) {
+    if (size < 12 || header[0] != 0x1f || header[1] != 0x8b || header[2] != 8 || !(header[3] & 4)) return 0;
+    size_t extraEnd = 12 + (header[10] | header[11] << 8);
+    if (size < extraEnd) return 0;
+    for (size_t field = 12; field + 4 <= extraEnd;) {
+        size_t fieldLength = header[field + 2] | header[field + 3] << 8;
+        if (header[field] == 'B' && header[field + 1] == 'C' && fieldLength == 2 && field + 6 <= extraEnd) {
+            return (header[field + 4] | header[field + 5] << 8) + 1;
+        }
+        field += 4 + fieldLength;
+    }
+    return 0;
+}
+
+// A filebuf whose buffered input can be looked at without consuming it, to recognise a compressed file
+// by its first bytes even when it is a pipe
+class PeekableFilebuf : public std::filebuf {
+public:
+    // Up to `count` bytes from the current position; fewer if the buffer or the file holds fewer
+    std::string peek(size_t count) {
+        if (traits_type::eq_int_type(sgetc(), traits_type::eof())) return std::string();
+        return std::string(gptr(), std::min<size_t>(count, egptr() - gptr()));
+    }
+};
+
+// A streambuf that yields the inflated contents of a gzip stream read from another streambuf
+class InflatingStreambuf : public std::streambuf {
+public:
+    InflatingStreambuf() : source(NULL), stopping(false), finished(false), broken(false), reported(false), batchLimit(0) {}
+    ~InflatingStreambuf() { close(); }
+    InflatingStreambuf(const InflatingStreambuf&) = delete;
+    InflatingStreambuf& operator=(const InflatingStreambuf&) = delete;
+
+    // Start inflating `compressed`, which must stay open until close(). BGZF data is inflated on
+    // `threadCount` workers (0: one per hardware thread), anything else on one background thread.
+    // `name` labels error messages.
+    void open(std::streambuf* compressed, bool bgzf, unsigned threadCount, const std::string& name) {
+        close();
+        source = compressed;
+        label = name;
+        stopping = finished = broken = reported = false;
+        if (bgzf) {
+            if (threadCount == 0) threadCount = std::max(1u, std::thread::hardware_concurrency());
+            for (unsigned t = 0; t < threadCount; t++) {
+                threads.push_back(std::thread([this] { inflateBatches(); }));
+            }
+            batchLimit = 2 * threadCount;
+        } else {
+            batchLimit = 0;
+            threads.push_back(std::thread([this] { inflateStream(); }));
+        }
+    }
+
+    // Stop the background threads and drop any data not read yet
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        for (size_t t = 0; t < threads.size(); t++) {
+            threads[t].join();
+        }
+        threads.clear();
+        blocks.clear();
+        batches.clear();
+        waiting.clear();
+        current.clear();
+        source = NULL;
+        setg(NULL, NULL, NULL);
+    }
+
+    // True once the data turned out to be corrupt or truncated; reading then ends early, as if at
+    // the end of the file
+    bool failed() const { return broken; }
+
+protected:
+    int_type underflow() override {
+        if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+        do {
+            if (!(batchLimit > 0 ? nextBatch() : nextBlock())) {
+                if (broken && !reported) {
+                    std::cerr << "Error: " << label << ": corrupt or truncated gzip data\n";
+                    reported = true;
+                }
+                return traits_type::eof();
+            }
+        } while (current.empty());  // BGZF end-of-file markers, which may sit between concatenated files
+        setg(current.data(), current.data(), current.data() + current.size());
+        return traits_type::to_int_type(*gptr());
+    }
+
+private:
+    // Inflated bytes handed over at a time by the streaming thread
+    static const size_t BLOCK_BYTES = 1 << 20;
+    // Compressed bytes of BGZF blocks inflated together by one worker
+    static const size_t BATCH_BYTES = 1 << 20;
+    // Largest inflated size of a BGZF block
+    static const size_t MAX_BGZF_BLOCK = 1 << 16;
+    // Inflated blocks the streaming thread may run ahead of the reader
+    static const size_t BLOCKS_AHEAD = 4;
+
+    // A run of whole BGZF blocks and, once a worker is done with it, their inflated contents
+    struct Batch {
+        std::vector<unsigned char> compressed;
+        std::vector<char> inflated;
+        bool done;
+        bool ok;
+    };
+
+    // Streaming thread: inflate member after member into blocks of BLOCK_BYTES
+    void inflateStream() {
+        z_stream stream;
+        memset(&stream, 0, sizeof(stream));
+        bool ok = inflateInit2(&stream, 15 + 16) == Z_OK;
+        std::vector<unsigned char> input(BLOCK_BYTES / 4);
+        std::vector<char> output(BLOCK_BYTES);
+        size_t filled = 0;
+        bool inMember = true;
+        while (ok && !stopping) {
+            if (stream.avail_in == 0) {
+                std::streamsize count = source->sgetn((char*)input.data(), input.size());
+                if (count <= 0) {
+                    ok = !inMember;
+                    break;
+                }
+                stream.next_in = input.data();
+                stream.avail_in = count;
+            }
+            if (!inMember) {
+                if (stream.next_in[0] != 0x1f) break;  // trailing padding after the last member
+                inflateReset(&stream);
+                inMember = true;
+            }
+            stream.next_out = (Bytef*)output.data() + filled;
+            stream.avail_out = output.size() - filled;
+            int status = inflate(&stream, Z_NO_FLUSH);
+            filled = output.size() - stream.avail_out;
+            if (status == Z_STREAM_END) {
+                inMember = false;
+            } else if (status != Z_OK && status != Z_BUF_ERROR) {
+                ok = false;
+            }
+            if (filled == output.size()) {
+                if (!pushBlock(output)) break;
+                output.assign(BLOCK_BYTES, 0);
+                filled = 0;
+            }
+        }
+        inflateEnd(&stream);
+        output.resize(filled);
+        if (!output.empty()) pushBlock(output);
+        std::lock_guard<std::mutex> lock(mutex);
+        finished = true;
+        if (!ok) broken = true;
+        changed.notify_all();
+    }
+
+    // Queue an inflated block for the reader, waiting while it is BLOCKS_AHEAD behind; false if stopping
+    bool pushBlock(std::vector<char>& block) {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] { return stopping || blocks.size() < BLOCKS_AHEAD; });
+        if (stopping) return false;
+        blocks.push_back(std::vector<char>());
+        blocks.back().swap(block);
+        changed.notify_all();
+        return true;
+    }
+
+    // Reader side of the streaming thread: take the next inflated block
+    bool nextBlock() {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] { return !blocks.empty() || finished; });
+        if (blocks.empty()) return false;
+        current.swap(blocks.front());
+        blocks.pop_front();
+        changed.notify_all();
+        return true;
+    }
+
+    // Read whole BGZF blocks into a batch until it holds BATCH_BYTES; false at end of input
+    bool readBatch(Batch& batch) {
+        unsigned char header[18];
+        while (batch.compressed.size() < BATCH_BYTES) {
+            std::streamsize count = source->sgetn((char*)header, sizeof(header));
+            if (count == 0) break;
+            size_t blockSize = count == (std::streamsize)sizeof(header) ? bgzfBlockSize(header, sizeof(header)) : 0;
+            if (blockSize < sizeof(header) + 8) {
+                broken = true;
+                break;
+            }
+            size_t start = batch.compressed.size();
+            batch.compressed.resize(start + blockSize);
+            memcpy(&batch.compressed[start], header, sizeof(header));
+            size_t rest = blockSize - sizeof(header);
+            if (source->sgetn((char*)&batch.compressed[start + sizeof(header)], rest) != (std::streamsize)rest) {
+                batch.compressed.resize(start);
+                broken = true;
+                break;
+            }
+        }
+        return !batch.compressed.empty();
+    }
+
+    // Inflate every block of a batch; each checks its own length and CRC
+    static bool inflateBatch(z_stream& stream, Batch& batch) {
+        const std::vector<unsigned char>& data = batch.compressed;
+        for (size_t block = 0; block < data.size();) {
+            size_t blockSize = bgzfBlockSize(&data[block], data.size() - block);
+            size_t dataStart = block + 12 + (data[block + 10] | data[block + 11] << 8);
+            size_t footer = block + blockSize - 8;
+            if (blockSize == 0 || dataStart > footer) return false;
+            uint32_t crc = data[footer] | data[footer + 1] << 8 | data[footer + 2] << 16 | (uint32_t)data[footer + 3] << 24;
+            size_t length = data[footer + 4] | data[footer + 5] << 8 | data[footer + 6] << 16 | (uint32_t)data[footer + 7] << 24;
+            if (length > MAX_BGZF_BLOCK) return false;
+            size_t start = batch.inflated.size();
+            batch.inflated.resize(start + length);
+            inflateReset(&stream);
+            stream.next_in = (Bytef*)&data[dataStart];
+            stream.avail_in = footer - dataStart;
+            stream.next_out = (Bytef*)batch.inflated.data() + start;
+            stream.avail_out = length;
+            if (inflate(&stream, Z_FINISH) != Z_STREAM_END || stream.avail_out != 0) return false;
+            if (crc32(0, (const Bytef*)batch.inflated.data() + start, length) != crc) return false;
+            block += blockSize;
+        }
+        return true;
+    }
+
+    // Worker thread: inflate batches as the reader queues them
+    void inflateBatches() {
+        z_stream stream;
+        memset(&stream, 0, sizeof(stream));
+        inflateInit2(&stream, -15);
+        for (;;) {
+            std::shared_ptr<Batch> batch;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [this] { return stopping || !waiting.empty(); });
+                if (stopping) break;
+                batch = waiting.front();
+                waiting.pop_front();
+            }
+            bool ok = inflateBatch(stream, *batch);
+            std::lock_guard<std::mutex> lock(mutex);
+            batch->ok = ok;
+            batch->done = true;
+            changed.notify_all();
+        }
+        inflateEnd(&stream);
+    }
+
+    // Reader side of the worker pool: keep batchLimit batches queued, then take the oldest once inflated
+    bool nextBatch() {
+        while (!finished && batches.size() < batchLimit) {
+            std::shared_ptr<Batch> batch(new Batch());
+            batch->done = batch->ok = false;
+            if (!readBatch(*batch)) {
+                finished = true;
+                break;
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            batches.push_back(batch);
+            waiting.push_back(batch);
+            changed.notify_all();
+        }
+        if (batches.empty()) return false;
+        std::shared_ptr<Batch> batch = batches.front();
+        batches.pop_front();
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&] { return batch->done; });
+        }
+        if (!batch->ok) {
+            broken = true;
+            return false;
+        }
+        current.swap(batch->inflated);
+        return true;
+    }
+
+    std::streambuf* source;
+    std::string label;
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::atomic<bool> stopping;                   // set under `mutex` (for the waits) but also polled without it
+    bool finished;                                // no more data will be queued
+    std::atomic<bool> broken;                     // the data is corrupt or truncated
+    bool reported;
+    std::deque<std::vector<char> > blocks;        // streaming: inflated blocks not read yet
+    size_t batchLimit;                            // BGZF: batches kept in flight; 0 when streaming
+    std::deque<std::shared_ptr<Batch> > batches;  // BGZF: batches in file order
+    std::deque<std::shared_ptr<Batch> > waiting;  // BGZF: batches no worker has taken yet
+    std::vector<char> current;                    // the data being read
+};
+
+// An input file stream that decompresses gzip and BGZF files in the background and reads any other
+// file as it is
+class InputFile : public std::istream {
+public:
+    InputFile() : std::istream(NULL) {}
+    explicit InputFile(const std::string& filename, unsigned threadCount = 0) : std::istream(NULL) {
+        open(filename, threadCount);
+    }
+
+    // Open a file; BGZF data is inflated on `threadCount` threads (0: one per hardware thread)
+    bool open(const std::string& filename, unsigned threadCount = 0) {
+        close();
+        if (file.open(filename.c_str(), std::ios::in | std::ios::binary) == NULL) {
+            setstate(std::ios::failbit);
+            return false;
+        }
+        std::string header = file.peek(18);
+        if (isGzipData(header.data(), header.size())) {
+            bool bgzf = bgzfBlockSize((const unsigned char*)header.data(), header.size()) > 0;
+            inflating.open(&file, bgzf, threadCount, filename);
+            rdbuf(&inflating);
+        } else {
+            rdbuf(&file);
+        }
+        return true;
+    }
+
+    bool is_open() const { return file.is_open(); }
+
+    // True if the file is being decompressed
+    bool compressed() const { return rdbuf() == &inflating; }
+
+    // True if the file is gzip data found to be corrupt or truncated. Reading stops at the damage with
+    // an ordinary end of file (and a message on stderr), so check this once the input is used up.
+    bool failed() const { return compressed() && inflating.failed(); }
+
+    void close() {
+        inflating.close();
+        file.close();
+        rdbuf(NULL);
+    }
+
+private:
+    PeekableFilebuf file;
+    InflatingStreambuf inflating;  // declared after `file`, so it stops reading before the file closes
+};
+
+#endif
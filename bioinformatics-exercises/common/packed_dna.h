@@ -0,0 +1,319 @@
+// 2-bit packed nucleotide sequences for the GC tools
+//
+// PackedSequence keeps A, C, G and T (U is read as T) in 2 bits each, 32 bases to a 64-bit word, a
+// quarter of the size of the text. Every other character (N and the other IUPAC ambiguity codes, gaps,
+// stop symbols) goes into a sparse side table of runs, so a stretch of 10,000 Ns is one entry, with a
+// placeholder A in the words. Letter case is not kept.
+//
+// Counting needs no per-base lookups. With A=00, C=01, G=10 and T=11 a base is G or C exactly when
+// its two bits differ, so popcount((word ^ word >> 1) & 0x5555...) counts the G+C of 32 bases at once;
+// the runs of the side table are then accounted for one run at a time.
+//
+// A set of records can be saved to a packed file and loaded back with a few bulk reads per record, so
+// repeat analyses of the same genome skip parsing the FASTA text.
+
+#ifndef BIOINFORMATICS_COMMON_PACKED_DNA_H
+#define BIOINFORMATICS_COMMON_PACKED_DNA_H
+
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <sys/stat.h>
+#include "base_counts.h"
+#include "fasta_index.h"
+#include "fasta_reader.h"
+
+// A run of one character other than A, C, G, T in a packed sequence
+struct BaseRun {
+    uint64_t start;
+    uint64_t length;
+    char code;  // the character, upper case
+};
+
+class PackedSequence {
+public:
+    PackedSequence() : count(0) {}
+
+    uint64_t size() const { return count; }
+    const std::vector<uint64_t>& words() const { return packed; }
+    const std::vector<BaseRun>& runs() const { return sideTable; }
+
+    void clear() {
+        packed.clear();
+        sideTable.clear();
+        count = 0;
+    }
+
+    // Append the bases of a piece of FASTA text; line breaks, spaces and tabs are skipped
+    void append(const char* text, size_t length) {
+        const unsigned char* codes = tables().code;
+        packed.reserve((count + length + 31) / 32);
+        for (size_t i = 0; i < length; i++) {
+            unsigned char code = codes[(unsigned char)text[i]];
+            if (code == SKIP) continue;
+            if (code == OTHER) {
+                char upper = (char)toupper((unsigned char)text[i]);
+                if (sideTable.empty() || sideTable.back().code != upper
+                    || sideTable.back().start + sideTable.back().length != count) {
+                    BaseRun run = {count, 0, upper};
+                    sideTable.push_back(run);
+                }
+                sideTable.back().length++;
+                code = 0;
+            }
+            if (count % 32 == 0) packed.push_back(0);
+            packed.back() |= (uint64_t)code << (2 * (count % 32));
+            count++;
+        }
+    }
+
+    void append(std::string_view text) { append(text.data(), text.size()); }
+
+    // The base at `position`, upper case
+    char at(uint64_t position) const {
+        const BaseRun* run = runAt(position);
+        if (run != NULL) return run->code;
+        return "ACGT"[(packed[position / 32] >> (2 * (position % 32))) & 3];
+    }
+
+    // Bases [start, end) as text
+    std::string decode(uint64_t start, uint64_t end) const {
+        std::string text;
+        text.reserve(end - start);
+        for (uint64_t position = start; position < end; position++) {
+            text += "ACGT"[(packed[position / 32] >> (2 * (position % 32))) & 3];
+        }
+        std::vector<BaseRun>::const_iterator run = firstRunEndingAfter(start);
+        for (; run != sideTable.end() && run->start < end; ++run) {
+            uint64_t from = std::max(run->start, start), to = std::min(run->start + run->length, end);
+            std::fill(text.begin() + (from - start), text.begin() + (to - start), run->code);
+        }
+        return text;
+    }
+
+    // Counts of bases [start, end)
+    BaseCounts counts(uint64_t start, uint64_t end) const {
+        BaseCounts result = {0, 0, 0, 0};
+        if (start >= end) return result;
+
+        // G+C of the packed words, placeholders (A) included, masking the ends of the range
+        uint64_t firstWord = start / 32, lastWord = (end - 1) / 32;
+        for (uint64_t w = firstWord; w <= lastWord; w++) {
+            uint64_t bits = (packed[w] ^ packed[w] >> 1) & 0x5555555555555555ull;
+            if (w == firstWord) bits &= ~0ull << (2 * (start % 32));
+            if (w == lastWord && end % 32 != 0) bits &= ~(~0ull << (2 * (end % 32)));
+            result.gc += __builtin_popcountll(bits);
+        }
+        result.at = end - start - result.gc;
+
+        // Runs replace their placeholder A's, which were counted as A+T
+        const unsigned char* classes = tables().baseClass;
+        std::vector<BaseRun>::const_iterator run = firstRunEndingAfter(start);
+        for (; run != sideTable.end() && run->start < end; ++run) {
+            uint64_t overlap = std::min(run->start + run->length, end) - std::max(run->start, start);
+            result.at -= overlap;
+            switch (classes[(unsigned char)run->code]) {
+                case GC_BASE: result.gc += overlap; break;
+                case AT_BASE: result.at += overlap; break;
+                case AMBIGUOUS_BASE: result.ambiguous += overlap; break;
+                default: result.other += overlap; break;
+            }
+        }
+        return result;
+    }
+
+    BaseCounts counts() const { return counts(0, count); }
+
+    // Write in the binary layout of packed files; read() reverses it
+    bool write(std::ostream& out) const {
+        uint64_t sizes[2] = {count, sideTable.size()};
+        out.write((const char*)sizes, sizeof(sizes));
+        for (size_t i = 0; i < sideTable.size(); i++) {
+            uint64_t fields[3] = {sideTable[i].start, sideTable[i].length, (unsigned char)sideTable[i].code};
+            out.write((const char*)fields, sizeof(fields));
+        }
+        out.write((const char*)packed.data(), packed.size() * sizeof(uint64_t));
+        return (bool)out;
+    }
+
+    // Read a sequence written by write(); `limit` bounds the bytes it may claim, so a damaged file
+    // fails instead of allocating without end
+    bool read(std::istream& in, uint64_t limit) {
+        clear();
+        uint64_t sizes[2];
+        if (!in.read((char*)sizes, sizeof(sizes)) || sizes[0] / 4 > limit || sizes[1] > limit / 24) return false;
+        sideTable.resize(sizes[1]);
+        for (size_t i = 0; i < sideTable.size(); i++) {
+            uint64_t fields[3];
+            if (!in.read((char*)fields, sizeof(fields))) return false;
+            BaseRun run = {fields[0], fields[1], (char)fields[2]};
+            sideTable[i] = run;
+        }
+        packed.resize((sizes[0] + 31) / 32);
+        if (!in.read((char*)packed.data(), packed.size() * sizeof(uint64_t))) return false;
+        count = sizes[0];
+        return true;
+    }
+
+private:
+    static const unsigned char SKIP = 4;
+    static const unsigned char OTHER = 5;
+    enum BaseClass { OTHER_BASE, GC_BASE, AT_BASE, AMBIGUOUS_BASE };
+
+    // Per-character tables, built once (thread-safely, being a function-local static)
+    struct Tables {
+        unsigned char code[256];      // 2-bit code, or SKIP (whitespace) or OTHER (side table)
+        unsigned char baseClass[256]; // BaseClass of each side-table character
+
+        Tables() {
+            std::fill(code, code + 256, OTHER);
+            code['\n'] = code['\r'] = code[' '] = code['\t'] = SKIP;
+            const char* bases = "ACGTacgt";
+            for (int i = 0; i < 8; i++) code[(unsigned char)bases[i]] = i % 4;
+            code['U'] = code['u'] = 3;
+            std::fill(baseClass, baseClass + 256, OTHER_BASE);
+            baseClass['S'] = GC_BASE;
+            baseClass['W'] = AT_BASE;
+            for (const char* c = "RYMKBDHVN"; *c != 0; c++) baseClass[(unsigned char)*c] = AMBIGUOUS_BASE;
+        }
+    };
+
+    static const Tables& tables() {
+        static const Tables built;
+        return built;
+    }
+
+    std::vector<BaseRun>::const_iterator firstRunEndingAfter(uint64_t position) const {
+        return std::upper_bound(sideTable.begin(), sideTable.end(), position,
+                                [](uint64_t p, const BaseRun& run) { return p < run.start + run.length; });
+    }
+
+    const BaseRun* runAt(uint64_t position) const {
+        std::vector<BaseRun>::const_iterator run = firstRunEndingAfter(position);
+        return run != sideTable.end() && run->start <= position ? &*run : NULL;
+    }
+
+    std::vector<uint64_t> packed;     // 32 bases per word, the first in the lowest bits
+    std::vector<BaseRun> sideTable;   // sorted, non-overlapping
+    uint64_t count;
+};
+
+// One record of a packed file
+struct PackedRecord {
+    std::string header;  // header line, '>' included
+    PackedSequence sequence;
+};
+
+// Packed files start with this header, followed by the records: the header length and text, then
+// the sequence as written by PackedSequence::write. Numbers are in the byte order of the machine that
+// wrote the file; byteOrderMark rejects files written on a machine with a different one.
+const char PACKED_MAGIC[8] = {'P', 'A', 'C', 'K', 'E', 'D', 'N', 'A'};
+const uint32_t PACKED_VERSION = 1;
+const uint32_t PACKED_BYTE_ORDER_MARK = 0x01020304;
+
+struct PackedFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrderMark;
+    uint64_t recordCount;
+};
+
+// True if the file starts with the packed file magic bytes. Only regular files are looked at, so a
+// pipe loses no data to the test.
+inline bool isPackedFile(const std::string& filename) {
+    struct stat status;
+    if (stat(filename.c_str(), &status) != 0 || !S_ISREG(status.st_mode)) return false;
+    std::ifstream file(filename.c_str(), std::ios::binary);
+    PackedFileHeader header;
+    return file.read((char*)&header, sizeof(header)) && memcmp(header.magic, PACKED_MAGIC, sizeof(PACKED_MAGIC)) == 0;
+}
+
+// Pack every record of a FASTA file (read with FastaReader, so gzip input works); false if the file cannot be
+// opened or is damaged gzip data
+inline bool packFastaFile(const std::string& filename, std::vector<PackedRecord>& records) {
+    records.clear();
+    FastaReader reader(false);
+    if (!reader.open(filename)) return false;
+    FastaRecord record;
+    while (reader.next(record)) {
+        if (record.header.empty()) continue;  // text before the first header
+        records.push_back(PackedRecord());
+        records.back().header.assign(record.header);
+        records.back().sequence.append(record.lines);
+    }
+    return !reader.failed();
+}
+
+// Index packed records by name (the header up to the first whitespace), so records and regions of
+// them can be picked with parseRegion(); entry i is record i
+inline void indexPackedRecords(const std::vector<PackedRecord>& records, FastaIndex& index) {
+    std::vector<FaiEntry> entries(records.size());
+    for (size_t i = 0; i < records.size(); i++) {
+        const std::string& header = records[i].header;
+        size_t nameEnd = 1;
+        while (nameEnd < header.size() && !isspace((unsigned char)header[nameEnd])) nameEnd++;
+        FaiEntry entry = {header.substr(1, nameEnd - 1), records[i].sequence.size(), 0, 0, 0};
+        entries[i] = entry;
+    }
+    index.assign(entries);
+}
+
+inline bool writePackedFile(const std::string& filename, const std::vector<PackedRecord>& records) {
+    std::ofstream file(filename.c_str(), std::ios::binary);
+    PackedFileHeader header;
+    memcpy(header.magic, PACKED_MAGIC, sizeof(header.magic));
+    header.version = PACKED_VERSION;
+    header.byteOrderMark = PACKED_BYTE_ORDER_MARK;
+    header.recordCount = records.size();
+    file.write((const char*)&header, sizeof(header));
+    for (size_t i = 0; i < records.size() && file; i++) {
+        uint64_t length = records[i].header.size();
+        file.write((const char*)&length, sizeof(length));
+        file.write(records[i].header.data(), length);
+        records[i].sequence.write(file);
+    }
+    return (bool)file.flush();
+}
+
+// Load a packed file; false with a message in `error` if it cannot be read or is not one
+inline bool readPackedFile(const std::string& filename, std::vector<PackedRecord>& records, std::string& error) {
+    records.clear();
+    std::ifstream file(filename.c_str(), std::ios::binary);
+    if (!file.is_open()) {
+        error = "Cannot open file \"" + filename + "\"";
+        return false;
+    }
+    file.seekg(0, std::ios::end);
+    uint64_t fileSize = file.tellg();
+    file.seekg(0, std::ios::beg);
+    PackedFileHeader header;
+    if (!file.read((char*)&header, sizeof(header)) || memcmp(header.magic, PACKED_MAGIC, sizeof(PACKED_MAGIC)) != 0) {
+        error = "\"" + filename + "\" is not a packed sequence file";
+        return false;
+    }
+    if (header.version != PACKED_VERSION || header.byteOrderMark != PACKED_BYTE_ORDER_MARK) {
+        error = "\"" + filename + "\" was written by another version or on a machine with another byte order";
+        return false;
+    }
+    for (uint64_t i = 0; i < header.recordCount; i++) {
+        uint64_t length;
+        if (!file.read((char*)&length, sizeof(length)) || length > fileSize) break;
+        records.push_back(PackedRecord());
+        records.back().header.resize(length);
+        if (!file.read(&records.back().header[0], length) || !records.back().sequence.read(file, fileSize)) break;
+    }
+    if (records.size() != header.recordCount || !file) {
+        records.clear();
+        error = "\"" + filename + "\" is damaged or truncated";
+        return false;
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,99 @@
+// Shared top-K selection for the ranking tools
+//
+// TopK keeps the K best entries seen so far in a binary heap with the worst kept entry at the
+// root, so an offer costs O(log K) and a rejected one O(1); K can be in the thousands. Entries are
+// small handles: a score, a key that breaks ties (lower ranks higher; callers use a database id or
+// a file position, which makes the order total and the result independent of insertion order) and
+// a payload such as a string_view of the record's header, so nothing large moves while the heap is
+// reordered. Lists built by separate threads are combined with merge().
+
+#ifndef BIOINFORMATICS_COMMON_TOP_K_H
+#define BIOINFORMATICS_COMMON_TOP_K_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+template <typename Payload>
+struct TopKEntry {
+    double score;
+    uint64_t key;
+    Payload payload;
+};
+
+template <typename Payload>
+class TopK {
+public:
+    typedef TopKEntry<Payload> Entry;
+
+    // Keep up to `capacity` entries; scores below `minimumScore` are never kept
+    explicit TopK(size_t capacity = 0, double minimumScore = -std::numeric_limits<double>::infinity())
+        : limit(capacity), threshold(minimumScore) {
+        heap.reserve(capacity);
+    }
+
+    size_t capacity() const { return limit; }
+    size_t size() const { return heap.size(); }
+    bool empty() const { return heap.empty(); }
+    double minimumScore() const { return threshold; }
+
+    // Ranking order: higher score first, lower key on ties
+    static bool ranksAbove(const Entry& a, const Entry& b) {
+        if (a.score != b.score) return a.score > b.score;
+        return a.key < b.key;
+    }
+
+    // True if an entry with this score and key would be kept. Callers check this before building
+    // a payload, so payloads are only made for entries that get in.
+    bool accepts(double score, uint64_t key) const {
+        if (!(score >= threshold) || limit == 0) return false;
+        if (heap.size() < limit) return true;
+        const Entry& worst = heap.front();
+        return score > worst.score || (score == worst.score && key < worst.key);
+    }
+
+    // Score an entry has to reach to be considered: the threshold until the list is full, then the
+    // K-th best score. Pruning against it never drops an entry that belongs in the list.
+    double floor() const {
+        if (heap.size() < limit) return threshold;
+        return std::max(threshold, heap.front().score);
+    }
+
+    // Keep the entry if it ranks among the K best; returns whether it was kept
+    bool offer(double score, uint64_t key, const Payload& payload) {
+        if (!accepts(score, key)) return false;
+        Entry entry = {score, key, payload};
+        if (heap.size() == limit) {
+            std::pop_heap(heap.begin(), heap.end(), ranksAbove);
+            heap.back() = entry;
+        } else {
+            heap.push_back(entry);
+        }
+        std::push_heap(heap.begin(), heap.end(), ranksAbove);
+        return true;
+    }
+
+    // Offer every entry of another list (built with the same capacity and threshold, e.g. by
+    // another thread); the result is the same whichever order lists are merged in
+    void merge(const TopK& other) {
+        for (size_t i = 0; i < other.heap.size(); i++) {
+            offer(other.heap[i].score, other.heap[i].key, other.heap[i].payload);
+        }
+    }
+
+    // Kept entries, best first
+    std::vector<Entry> sorted() const {
+        std::vector<Entry> entries(heap);
+        std::sort(entries.begin(), entries.end(), ranksAbove);
+        return entries;
+    }
+
+private:
+    size_t limit;
+    double threshold;
+    std::vector<Entry> heap;  // max-heap under ranksAbove: the worst kept entry is at the front
+};
+
+#endif
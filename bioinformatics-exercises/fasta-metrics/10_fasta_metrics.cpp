@@ -4,38 +4,129 @@
 #include <fstream>
 #include <string>
 #include <vector>
-#include <set>
+#include <algorithm>
 #include <sstream>
 #include <iomanip>
+#include <cstdint>
+#include <cstring>
+#include <climits>
+#include <cstdlib>
+#include <ctime>
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <unordered_map>
+#include <type_traits>
+#include <string_view>
+
+#include "../common/fasta_reader.h"
+#include "../common/fasta_index.h"
+#include "../common/gzip_input.h"
+#include "../common/top_k.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
 
 using namespace std;
 
 const int MAX_AMINO_ACIDS = 21; 
-int ASCII[128] = {0}; // Initialize all to zero
+int ASCII[256] = {0}; // One entry per byte value, all zero (unknown residue) until initialized
+
+// Peptide lengths the k-mer engine is instantiated for
+const int MIN_K = 2;
+const int MAX_K = 7;
+const int DEFAULT_K = 4;
+// Largest code space that still gets bitmaps: 21^4 bits is ~24 KB, 21^5 would already be ~500 KB
+const uint64_t MAX_DENSE_SPACE = 194481;
+
+// Number of distinct k-mers over the 21-letter alphabet (20 amino acids plus "other")
+constexpr uint64_t kmerSpace(int k) { return k == 0 ? 1 : MAX_AMINO_ACIDS * kmerSpace(k - 1); }
+
+// Bits needed to hold any value below n
+constexpr int bitWidth(uint64_t n) { return n <= 1 ? 0 : 1 + bitWidth((n + 1) / 2); }
+
+// Bitmap words for a code space, rounded up to whole 512-bit blocks so the SIMD kernels need no tail loop
+constexpr size_t bitmapWords(uint64_t space) { return space <= MAX_DENSE_SPACE ? (space + 511) / 512 * 8 : 0; }
+
+// Everything the engine needs to know about one k, computed at compile time
+template <int K>
+struct KmerTraits {
+    static_assert(K >= MIN_K && K <= MAX_K, "k must be between 2 and 7");
+    static constexpr uint64_t SPACE = kmerSpace(K);
+    // Place value of the residue that leaves the rolling window
+    static constexpr uint32_t LEADING_PLACE = kmerSpace(K - 1);
+    static constexpr int CODE_BITS = bitWidth(SPACE);
+    static_assert(CODE_BITS <= 32, "k-mer codes must fit in 32 bits");
+    // Sets with at least WORDS distinct k-mers also get a bitmap; smaller ones stay as a sorted code list.
+    // A merge walks |A| + |B| codes while the bitmap kernel always walks WORDS words, so the bitmap
+    // only pays off once both sets hold about as many codes as the bitmap has words.
+    // Code spaces above MAX_DENSE_SPACE never use bitmaps.
+    static constexpr size_t WORDS = bitmapWords(SPACE);
+    static constexpr size_t DENSE_THRESHOLD = WORDS > 0 ? WORDS : SIZE_MAX;
+};
 
-// Structure to hold protein information
+// Name of a peptide of length k, for report headings
+const char* peptideName(int k) {
+    static const char* const names[] = {"", "", "dipeptide", "tripeptide", "tetrapeptide",
+                                        "pentapeptide", "hexapeptide", "heptapeptide"};
+    return names[k];
+}
+
+// Payload of a match kept in a top list. Matches are keyed by protein id (position in the database,
+// which breaks ties so results do not depend on thread count); the header is a view into the
+// database, or into headers set aside by a streaming search, so it is never copied while a list
+// is reordered.
 struct ProteinInfo {
-    string name;
+    string_view name;
     int length;
-    double jaccardIndex;
 };
 
-// Structure to represent a tetrapeptide (4 amino acids)
-struct Tetrapeptide {
-    int a, b, c, d;
-    
-    // Constructor
-    Tetrapeptide(int a_, int b_, int c_, int d_) : a(a_), b(b_), c(c_), d(d_) {}
-    
-    // Operator for comparison in set
-    bool operator<(const Tetrapeptide& other) const {
-        if (a != other.a) return a < other.a;
-        if (b != other.b) return b < other.b;
-        if (c != other.c) return c < other.c;
-        return d < other.d;
-    }
+typedef TopK<ProteinInfo> TopList;
+typedef TopList::Entry Match; // score: Jaccard similarity, key: protein id
+
+// Switch from a linear merge to galloping search when one list is this many times longer than the other
+const size_t GALLOP_RATIO = 32;
+// Database proteins shorter than this are not scored
+const size_t MIN_PROTEIN_LENGTH = 100;
+
+// Set of k-mers stored as sorted, deduplicated base-21 codes (for k = 4: a*21^3 + b*21^2 + c*21 + d),
+// plus a bit-packed copy (~24 KB for k = 4) for sets large enough that the popcount kernel beats a merge
+struct KmerSet {
+    vector<uint32_t> codes;
+    vector<uint64_t> bits; // empty unless the set is dense
+
+    bool isDense() const { return !bits.empty(); }
 };
 
+// Non-owning view of a k-mer set, pointing either into a KmerSet or into a mapped index file
+struct KmerSpan {
+    const uint32_t* codes;
+    size_t size;
+    const uint64_t* bits; // null unless the set is dense
+
+    bool isDense() const { return bits != NULL; }
+};
+
+KmerSpan spanOf(const KmerSet& kmers) {
+    KmerSpan span = {kmers.codes.data(), kmers.codes.size(), kmers.isDense() ? kmers.bits.data() : NULL};
+    return span;
+}
+
 // Initialize ASCII array for amino acid conversion
 void initializeASCII() {
     ASCII['A'] = 1;
@@ -83,251 +174,2681 @@ void initializeASCII() {
 
 // Convert amino acid character to index (0-20)
 int aminoAcidToIndex(char aa) {
-    // Character is always less than 128 in standard ASCII
-    return ASCII[(unsigned char)aa]; // Cast to unsigned char to prevent out of bounds
+    return ASCII[(unsigned char)aa]; // Bytes 128-255 (e.g. Latin-1 text) are unknown residues, index 0
 }
 
-// Trim whitespace from a string
-string trim(const string& str) {
-    size_t start = str.find_first_not_of(" \t\r\n");
-    size_t end = str.find_last_not_of(" \t\r\n");
-    if (start == string::npos || end == string::npos) {
-        return "";
+// Encode a sequence once into its sorted, deduplicated list of k-mer codes using a rolling base-21 code.
+// The first K - 1 residues only prime the window, so the main loop has no per-residue test.
+template <int K>
+void encodeKmerCodes(const string& sequence, vector<uint32_t>& codes) {
+    codes.clear();
+    if (sequence.size() < (size_t)K) return;
+
+    uint32_t code = 0;
+    for (int i = 0; i < K - 1; i++) {
+        code = code * MAX_AMINO_ACIDS + aminoAcidToIndex(sequence[i]);
     }
-    return str.substr(start, end - start + 1);
+    codes.reserve(sequence.size() - K + 1);
+    for (size_t i = K - 1; i < sequence.size(); i++) {
+        // Drop the residue leaving the window, shift in the new one
+        code = (code % KmerTraits<K>::LEADING_PLACE) * MAX_AMINO_ACIDS + aminoAcidToIndex(sequence[i]);
+        codes.push_back(code);
+    }
+    sort(codes.begin(), codes.end());
+    codes.erase(unique(codes.begin(), codes.end()), codes.end());
 }
 
-// Populate tetrapeptide array from a sequence
-void populateTetramerArray(const string& sequence, bool tetramers[21][21][21][21]) {
-    set<Tetrapeptide> seenTetramers; // Set to track unique tetramers using custom struct
-    
-    for (int i = 0; i + 3 < sequence.size(); i++) {
-        int a = aminoAcidToIndex(sequence[i]);
-        int b = aminoAcidToIndex(sequence[i + 1]);
-        int c = aminoAcidToIndex(sequence[i + 2]);
-        int d = aminoAcidToIndex(sequence[i + 3]);
-        
-        Tetrapeptide tetramer(a, b, c, d);
-        
-        if (seenTetramers.find(tetramer) == seenTetramers.end()) {
-            tetramers[a][b][c][d] = true; 
-            seenTetramers.insert(tetramer);
+// Populate a k-mer set from a sequence, choosing the dense or sparse representation by set size
+template <int K>
+void populateKmerSet(const string& sequence, KmerSet& kmers) {
+    encodeKmerCodes<K>(sequence, kmers.codes);
+
+    kmers.bits.clear();
+    if (kmers.codes.size() >= KmerTraits<K>::DENSE_THRESHOLD) {
+        kmers.bits.assign(KmerTraits<K>::WORDS, 0);
+        for (size_t i = 0; i < kmers.codes.size(); i++) {
+            uint32_t code = kmers.codes[i];
+            kmers.bits[code >> 6] |= uint64_t(1) << (code & 63);
         }
     }
 }
 
-// Calculate Jaccard Index between two tetrapeptide arrays
-double calculateJaccardIndex(bool queryTetramers[21][21][21][21], 
-                             bool dbTetramers[21][21][21][21]) {
-    int intersection = 0, unionCount = 0;
-    
-    for (int a = 0; a < MAX_AMINO_ACIDS; a++) {
-        for (int b = 0; b < MAX_AMINO_ACIDS; b++) {
-            for (int c = 0; c < MAX_AMINO_ACIDS; c++) {
-                for (int d = 0; d < MAX_AMINO_ACIDS; d++) {
-                    if (queryTetramers[a][b][c][d] || dbTetramers[a][b][c][d]) {
-                        unionCount++;
-                    }
-                    
-                    if (queryTetramers[a][b][c][d] && dbTetramers[a][b][c][d]) {
-                        intersection++;
-                    }
-                }
-            }
+// Count common codes of two sorted lists with a branch-free merge
+size_t mergeIntersectionCount(const uint32_t* a, size_t sizeA, const uint32_t* b, size_t sizeB) {
+    size_t i = 0, j = 0, count = 0;
+    while (i < sizeA && j < sizeB) {
+        uint32_t x = a[i], y = b[j];
+        count += (x == y);
+        i += (x <= y);
+        j += (y <= x);
+    }
+    return count;
+}
+
+// Merge as above, but give up as soon as the lists can no longer share `needed` codes; the result is then
+// some count below `needed`. The bound is checked once per block: a block never takes more steps than
+// either list has codes left, so the steps inside it need no end-of-list tests.
+size_t mergeIntersectionCountAtLeast(const uint32_t* a, size_t sizeA, const uint32_t* b, size_t sizeB,
+                                     size_t needed) {
+    const size_t blockSize = 64;
+    size_t i = 0, j = 0, count = 0;
+    while (i < sizeA && j < sizeB) {
+        size_t remaining = min(sizeA - i, sizeB - j);
+        if (count + remaining < needed) return count;
+        for (size_t step = min(blockSize, remaining); step > 0; step--) {
+            uint32_t x = a[i], y = b[j];
+            count += (x == y);
+            i += (x <= y);
+            j += (y <= x);
+        }
+    }
+    return count;
+}
+
+// Count common codes when `small` is much shorter than `large`: exponential then binary search
+// for each code of the short list, resuming from the previous match position
+size_t gallopIntersectionCount(const uint32_t* small, size_t sizeSmall, const uint32_t* large, size_t sizeLarge) {
+    size_t count = 0, low = 0;
+    for (size_t i = 0; i < sizeSmall && low < sizeLarge; i++) {
+        uint32_t target = small[i];
+        size_t step = 1, high = low;
+        while (high < sizeLarge && large[high] < target) {
+            low = high + 1;
+            high += step;
+            step <<= 1;
+        }
+        if (high > sizeLarge) high = sizeLarge;
+        low = lower_bound(large + low, large + high, target) - large;
+        if (low < sizeLarge && large[low] == target) {
+            count++;
+            low++;
         }
     }
+    return count;
+}
+
+// Count codes of a sparse list that are set in a dense bitmap
+size_t probeIntersectionCount(const uint32_t* codes, size_t size, const uint64_t* bits) {
+    size_t count = 0;
+    for (size_t i = 0; i < size; i++) {
+        count += (bits[codes[i] >> 6] >> (codes[i] & 63)) & 1;
+    }
+    return count;
+}
+
+// Intersection and union sizes of two k-mer sets
+struct JaccardCounts {
+    uint64_t intersection;
+    uint64_t unionCount;
+};
+
+// Portable kernel: one AND/OR plus popcount per 64-bit word
+JaccardCounts jaccardCountsScalar(const uint64_t* query, const uint64_t* db, size_t words) {
+    JaccardCounts counts = {0, 0};
+    for (size_t i = 0; i < words; i++) {
+        counts.intersection += __builtin_popcountll(query[i] & db[i]);
+        counts.unionCount += __builtin_popcountll(query[i] | db[i]);
+    }
+    return counts;
+}
+
+#ifdef HAVE_X86_SIMD
+// Per-byte popcount via a 16-entry nibble lookup table (vpshufb), summed into 64-bit lanes with vpsadbw
+__attribute__((target("avx2")))
+static inline __m256i popcount256(__m256i v) {
+    const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i lowMask = _mm256_set1_epi8(0x0f);
+    __m256i lo = _mm256_and_si256(v, lowMask);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), lowMask);
+    __m256i bytes = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo), _mm256_shuffle_epi8(lookup, hi));
+    return _mm256_sad_epu8(bytes, _mm256_setzero_si256());
+}
+
+__attribute__((target("avx2")))
+JaccardCounts jaccardCountsAVX2(const uint64_t* query, const uint64_t* db, size_t words) {
+    __m256i inter = _mm256_setzero_si256();
+    __m256i uni = _mm256_setzero_si256();
+    for (size_t i = 0; i < words; i += 4) {
+        __m256i q = _mm256_loadu_si256((const __m256i*)(query + i));
+        __m256i d = _mm256_loadu_si256((const __m256i*)(db + i));
+        inter = _mm256_add_epi64(inter, popcount256(_mm256_and_si256(q, d)));
+        uni = _mm256_add_epi64(uni, popcount256(_mm256_or_si256(q, d)));
+    }
+    alignas(32) uint64_t lanes[8];
+    _mm256_store_si256((__m256i*)lanes, inter);
+    _mm256_store_si256((__m256i*)(lanes + 4), uni);
+    JaccardCounts counts;
+    counts.intersection = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    counts.unionCount = lanes[4] + lanes[5] + lanes[6] + lanes[7];
+    return counts;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static inline __m512i popcount512(__m512i v) {
+    // The 16-entry table repeated in each 128-bit lane (vpshufb looks up within lanes); bytes little-endian
+    const __m512i lookup = _mm512_set4_epi64(0x0403030203020201ll, 0x0302020102010100ll,
+                                             0x0403030203020201ll, 0x0302020102010100ll);
+    const __m512i lowMask = _mm512_set1_epi8(0x0f);
+    __m512i lo = _mm512_and_si512(v, lowMask);
+    __m512i hi = _mm512_and_si512(_mm512_srli_epi16(v, 4), lowMask);
+    __m512i bytes = _mm512_add_epi8(_mm512_shuffle_epi8(lookup, lo), _mm512_shuffle_epi8(lookup, hi));
+    return _mm512_sad_epu8(bytes, _mm512_setzero_si512());
+}
+
+__attribute__((target("avx512f,avx512bw")))
+JaccardCounts jaccardCountsAVX512(const uint64_t* query, const uint64_t* db, size_t words) {
+    __m512i inter = _mm512_setzero_si512();
+    __m512i uni = _mm512_setzero_si512();
+    for (size_t i = 0; i < words; i += 8) {
+        __m512i q = _mm512_loadu_si512((const void*)(query + i));
+        __m512i d = _mm512_loadu_si512((const void*)(db + i));
+        inter = _mm512_add_epi64(inter, popcount512(_mm512_and_si512(q, d)));
+        uni = _mm512_add_epi64(uni, popcount512(_mm512_or_si512(q, d)));
+    }
+    alignas(64) uint64_t lanes[16];
+    _mm512_store_si512((void*)lanes, inter);
+    _mm512_store_si512((void*)(lanes + 8), uni);
+    JaccardCounts counts = {0, 0};
+    for (int lane = 0; lane < 8; lane++) {
+        counts.intersection += lanes[lane];
+        counts.unionCount += lanes[8 + lane];
+    }
+    return counts;
+}
+#endif
+
+// Kernels take the bitmap length in words, a multiple of 8
+typedef JaccardCounts (*JaccardKernel)(const uint64_t*, const uint64_t*, size_t);
+
+// Pick the widest kernel the running CPU supports
+JaccardKernel selectJaccardKernel() {
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512bw")) return jaccardCountsAVX512;
+    if (__builtin_cpu_supports("avx2")) return jaccardCountsAVX2;
+#endif
+    return jaccardCountsScalar;
+}
+
+const JaccardKernel jaccardKernel = selectJaccardKernel();
+
+// Highest Jaccard index two sets of these sizes can reach: min(|A|, |B|) / max(|A|, |B|)
+inline double jaccardUpperBound(size_t sizeA, size_t sizeB) {
+    if (sizeA > sizeB) swap(sizeA, sizeB);
+    return sizeB == 0 ? 0.0 : (double)(sizeA) / sizeB;
+}
+
+// Calculate Jaccard Index between two k-mer sets. If the sets turn out unable to reach `floor`, the
+// sparse merge may stop early and return any value below `floor` instead of the exact index.
+template <int K>
+double calculateJaccardIndex(const KmerSpan& queryKmers, const KmerSpan& dbKmers, double floor = -1) {
+    const uint32_t* q = queryKmers.codes;
+    const uint32_t* d = dbKmers.codes;
+    size_t qSize = queryKmers.size, dSize = dbKmers.size;
+    size_t intersection;
+
+    if (queryKmers.isDense() && dbKmers.isDense()) {
+        intersection = jaccardKernel(queryKmers.bits, dbKmers.bits, KmerTraits<K>::WORDS).intersection;
+    } else if (queryKmers.isDense()) {
+        intersection = probeIntersectionCount(d, dSize, queryKmers.bits);
+    } else if (dbKmers.isDense()) {
+        intersection = probeIntersectionCount(q, qSize, dbKmers.bits);
+    } else if (qSize * GALLOP_RATIO < dSize) {
+        intersection = gallopIntersectionCount(q, qSize, d, dSize);
+    } else if (dSize * GALLOP_RATIO < qSize) {
+        intersection = gallopIntersectionCount(d, dSize, q, qSize);
+    } else if (floor > 0) {
+        // I / (|Q| + |D| - I) >= floor  <=>  I >= floor * (|Q| + |D|) / (1 + floor)
+        size_t needed = (size_t)(floor * (qSize + dSize) / (1 + floor));
+        intersection = mergeIntersectionCountAtLeast(q, qSize, d, dSize, needed);
+        if (intersection < needed) return -1;
+    } else {
+        intersection = mergeIntersectionCount(q, qSize, d, dSize);
+    }
 
+    size_t unionCount = qSize + dSize - intersection;
     if (unionCount == 0) return 0.0;
 
     return (double)(intersection) / unionCount;
 }
 
+// Hash values kept per bottom-k sketch
+const size_t SKETCH_SIZE = 64;
+// Pads sketches of sets with fewer than SKETCH_SIZE k-mers; larger than any real hash in use
+const uint32_t SKETCH_PADDING = 0xffffffffu;
+
+// Bijective 32-bit mixer (so distinct k-mer codes never collide), used to order codes for sketching
+// and to spread codes over the query tiles' filters
+inline uint32_t hashKmerCode(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// Bottom-k sketch: the SKETCH_SIZE smallest code hashes in ascending order, padded with SKETCH_PADDING
+void computeSketch(const vector<uint32_t>& codes, uint32_t* sketch) {
+    vector<uint32_t> hashes(codes.size());
+    for (size_t i = 0; i < codes.size(); i++) {
+        hashes[i] = hashKmerCode(codes[i]);
+    }
+    size_t kept = min(hashes.size(), SKETCH_SIZE);
+    partial_sort(hashes.begin(), hashes.begin() + kept, hashes.end());
+    for (size_t i = 0; i < SKETCH_SIZE; i++) {
+        sketch[i] = i < kept ? hashes[i] : SKETCH_PADDING;
+    }
+}
+
+// Estimate Jaccard from two bottom-k sketches: of the SKETCH_SIZE smallest hashes of the union, the
+// fraction present in both sets. That sample is always contained in the two sketches.
+double estimateJaccardIndex(const uint32_t* a, const uint32_t* b) {
+    size_t i = 0, j = 0, taken = 0, shared = 0;
+    while (taken < SKETCH_SIZE) {
+        uint32_t x = i < SKETCH_SIZE ? a[i] : SKETCH_PADDING;
+        uint32_t y = j < SKETCH_SIZE ? b[j] : SKETCH_PADDING;
+        if (x == SKETCH_PADDING && y == SKETCH_PADDING) break;
+        shared += (x == y);
+        i += (x <= y);
+        j += (y <= x);
+        taken++;
+    }
+    return taken == 0 ? 0.0 : (double)(shared) / taken;
+}
+
+// ---------------------------------------------------------------------------------------------
+// Local alignment
+//
+// Smith-Waterman scores with BLOSUM62 and affine gaps, used to re-rank the best Jaccard hits.
+// Residues are the same 0-20 indices the k-mer codes are built from (0: any other letter, scored as X).
+// ---------------------------------------------------------------------------------------------
+
+// A gap of length L costs GAP_OPEN + L * GAP_EXTEND (the BLAST defaults for BLOSUM62)
+const int GAP_OPEN = 11;
+const int GAP_EXTEND = 1;
+
+// BLOSUM62 in residue index order: X, A R N D C Q E G H I L K M F P S T W Y V
+const int8_t BLOSUM62[MAX_AMINO_ACIDS][MAX_AMINO_ACIDS] = {
+    {-1,  0, -1, -1, -1, -2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -2,  0,  0, -2, -1, -1},
+    { 0,  4, -1, -2, -2,  0, -1, -1,  0, -2, -1, -1, -1, -1, -2, -1,  1,  0, -3, -2,  0},
+    {-1, -1,  5,  0, -2, -3,  1,  0, -2,  0, -3, -2,  2, -1, -3, -2, -1, -1, -3, -2, -3},
+    {-1, -2,  0,  6,  1, -3,  0,  0,  0,  1, -3, -3,  0, -2, -3, -2,  1,  0, -4, -2, -3},
+    {-1, -2, -2,  1,  6, -3,  0,  2, -1, -1, -3, -4, -1, -3, -3, -1,  0, -1, -4, -3, -3},
+    {-2,  0, -3, -3, -3,  9, -3, -4, -3, -3, -1, -1, -3, -1, -2, -3, -1, -1, -2, -2, -1},
+    {-1, -1,  1,  0,  0, -3,  5,  2, -2,  0, -3, -2,  1,  0, -3, -1,  0, -1, -2, -1, -2},
+    {-1, -1,  0,  0,  2, -4,  2,  5, -2,  0, -3, -3,  1, -2, -3, -1,  0, -1, -3, -2, -2},
+    {-1,  0, -2,  0, -1, -3, -2, -2,  6, -2, -4, -4, -2, -3, -3, -2,  0, -2, -2, -3, -3},
+    {-1, -2,  0,  1, -1, -3,  0,  0, -2,  8, -3, -3, -1, -2, -1, -2, -1, -2, -2,  2, -3},
+    {-1, -1, -3, -3, -3, -1, -3, -3, -4, -3,  4,  2, -3,  1,  0, -3, -2, -1, -3, -1,  3},
+    {-1, -1, -2, -3, -4, -1, -2, -3, -4, -3,  2,  4, -2,  2,  0, -3, -2, -1, -2, -1,  1},
+    {-1, -1,  2,  0, -1, -3,  1,  1, -2, -1, -3, -2,  5, -1, -3, -1,  0, -1, -3, -2, -2},
+    {-1, -1, -1, -2, -3, -1,  0, -2, -3, -2,  1,  2, -1,  5,  0, -2, -1, -1, -1, -1,  1},
+    {-1, -2, -3, -3, -3, -2, -3, -3, -3, -1,  0,  0, -3,  0,  6, -4, -2, -2,  1,  3, -1},
+    {-2, -1, -2, -2, -1, -3, -1, -1, -2, -2, -3, -3, -1, -2, -4,  7, -1, -1, -4, -3, -2},
+    { 0,  1, -1,  1,  0, -1,  0,  0,  0, -1, -2, -2,  0, -1, -2, -1,  4,  1, -3, -2, -2},
+    { 0,  0, -1,  0, -1, -1, -1, -1, -2, -2, -1, -1, -1, -1, -2, -1,  1,  5, -2, -2,  0},
+    {-2, -3, -3, -4, -4, -2, -2, -3, -2, -2, -3, -2, -3, -1,  1, -4, -3, -2, 11,  2, -3},
+    {-1, -2, -2, -2, -3, -2, -1, -2, -3,  2, -1, -1, -2, -1,  3, -3, -2, -2,  2,  7, -1},
+    {-1,  0, -3, -3, -3, -1, -2, -2, -3, -3,  3,  1, -2,  1, -1, -2, -2,  0, -3, -1,  4}
+};
+// Highest BLOSUM62 score; keeps the 16-bit kernel clear of saturation
+const int BLOSUM62_MAX = 11;
+
+// Encode a sequence as residue indices
+void encodeResidues(const string& sequence, vector<uint8_t>& residues) {
+    residues.resize(sequence.size());
+    for (size_t i = 0; i < sequence.size(); i++) {
+        residues[i] = aminoAcidToIndex(sequence[i]);
+    }
+}
+
+// Gotoh's Smith-Waterman with 32-bit scores, one query column at a time. Used where SIMD is not
+// available and when the 16-bit kernel saturates.
+int smithWatermanScalar(const uint8_t* query, size_t queryLength, const uint8_t* target, size_t targetLength) {
+    vector<int> H(queryLength + 1, 0); // best score ending at (i, previous target position)
+    vector<int> E(queryLength + 1, 0); // same, ending in a gap in the query
+    int best = 0;
+    for (size_t j = 0; j < targetLength; j++) {
+        const int8_t* scores = BLOSUM62[target[j]];
+        int diagonal = 0, F = 0, above = 0;
+        for (size_t i = 1; i <= queryLength; i++) {
+            E[i] = max(E[i] - GAP_EXTEND, H[i] - GAP_OPEN - GAP_EXTEND);
+            F = max(F - GAP_EXTEND, above - GAP_OPEN - GAP_EXTEND);
+            int h = max(max(0, diagonal + scores[query[i - 1]]), max(E[i], F));
+            diagonal = H[i];
+            H[i] = h;
+            above = h;
+            best = max(best, h);
+        }
+    }
+    return best;
+}
+
+// A query prepared for alignment against many targets
+struct AlignmentProfile {
+    vector<uint8_t> query;
+#if HAVE_X86_SIMD
+    // Farrar's striped layout: for residue r, segment j, lane l holds the score of r against query
+    // position j + l * segmentCount (0 past the end of the query)
+    // (operator new returns 16-byte aligned blocks on x86-64, so the lanes are used as __m128i in place)
+    size_t segmentCount;
+    vector<int16_t> scores; // MAX_AMINO_ACIDS * segmentCount vectors of 8 lanes
+#endif
+};
+
+void buildAlignmentProfile(const vector<uint8_t>& query, AlignmentProfile& profile) {
+    profile.query = query;
+#if HAVE_X86_SIMD
+    const size_t lanes = 8;
+    size_t segmentCount = max<size_t>(1, (query.size() + lanes - 1) / lanes);
+    profile.segmentCount = segmentCount;
+    profile.scores.resize(MAX_AMINO_ACIDS * segmentCount * lanes);
+    for (int r = 0; r < MAX_AMINO_ACIDS; r++) {
+        for (size_t j = 0; j < segmentCount; j++) {
+            for (size_t l = 0; l < lanes; l++) {
+                size_t position = j + l * segmentCount;
+                profile.scores[(r * segmentCount + j) * lanes + l] = position < query.size() ? BLOSUM62[r][query[position]] : 0;
+            }
+        }
+    }
+#endif
+}
+
+#if HAVE_X86_SIMD
+// Farrar's striped Smith-Waterman on 8 signed 16-bit lanes (SSE2 is part of x86-64, so no dispatch is
+// needed). Each target residue updates the whole query column in segmentCount vector steps; vertical
+// gaps that cross a segment boundary are fixed up afterwards by the lazy-F loop. Returns -1 if the
+// score may have saturated.
+int smithWatermanStriped(const AlignmentProfile& profile, const uint8_t* target, size_t targetLength) {
+    const size_t segmentCount = profile.segmentCount;
+    const __m128i* profileScores = (const __m128i*)profile.scores.data();
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i gapOpen = _mm_set1_epi16(GAP_OPEN + GAP_EXTEND);
+    const __m128i gapExtend = _mm_set1_epi16(GAP_EXTEND);
+    const __m128i negativeFirstLane = _mm_set_epi16(0, 0, 0, 0, 0, 0, 0, INT16_MIN);
+    vector<int16_t> buffers(3 * segmentCount * 8, 0);
+    __m128i* hStore = (__m128i*)buffers.data();
+    __m128i* hLoad = hStore + segmentCount;
+    __m128i* e = hLoad + segmentCount;
+    __m128i best = zero;
+
+    for (size_t t = 0; t < targetLength; t++) {
+        const __m128i* column = profileScores + target[t] * segmentCount;
+        __m128i f = _mm_set1_epi16(INT16_MIN);
+        // Diagonal predecessor of each lane's first cell: the previous column shifted down one lane
+        __m128i h = _mm_slli_si128(hStore[segmentCount - 1], 2);
+        swap(hLoad, hStore);
+
+        for (size_t j = 0; j < segmentCount; j++) {
+            h = _mm_adds_epi16(h, column[j]);
+            __m128i ej = e[j];
+            h = _mm_max_epi16(h, ej);
+            h = _mm_max_epi16(h, f);
+            h = _mm_max_epi16(h, zero);
+            best = _mm_max_epi16(best, h);
+            hStore[j] = h;
+
+            h = _mm_subs_epi16(h, gapOpen);
+            e[j] = _mm_max_epi16(_mm_subs_epi16(ej, gapExtend), h);
+            f = _mm_max_epi16(_mm_subs_epi16(f, gapExtend), h);
+            h = hLoad[j];
+        }
+
+        // Lazy F: carry vertical gaps into the next lane until they no longer raise any cell
+        f = _mm_or_si128(_mm_slli_si128(f, 2), negativeFirstLane);
+        size_t j = 0;
+        while (_mm_movemask_epi8(_mm_cmpgt_epi16(f, _mm_subs_epi16(hStore[j], gapOpen)))) {
+            h = _mm_max_epi16(hStore[j], f);
+            hStore[j] = h;
+            e[j] = _mm_max_epi16(e[j], _mm_subs_epi16(h, gapOpen));
+            f = _mm_subs_epi16(f, gapExtend);
+            if (++j == segmentCount) {
+                j = 0;
+                f = _mm_or_si128(_mm_slli_si128(f, 2), negativeFirstLane);
+            }
+        }
+    }
+
+    int16_t lanes[8];
+    _mm_storeu_si128((__m128i*)lanes, best);
+    int score = *max_element(lanes, lanes + 8);
+    return score >= INT16_MAX - BLOSUM62_MAX ? -1 : score;
+}
+#endif
+
+// Local alignment score of the profile's query against a target
+int smithWatermanScore(const AlignmentProfile& profile, const uint8_t* target, size_t targetLength) {
+#if HAVE_X86_SIMD
+    int score = smithWatermanStriped(profile, target, targetLength);
+    if (score >= 0) return score;
+#endif
+    return smithWatermanScalar(profile.query.data(), profile.query.size(), target, targetLength);
+}
+
 // Pair struct to hold header and sequence together
 struct FastaPair {
     string header;
     string sequence;
 };
 
-// Read a FASTA file and extract headers and sequences
-string readFastaFile(const string& filename, vector<string>& headers, vector<string>& sequences) {
-    ifstream file(filename.c_str()); // Use of .c_str() for older C++ compatibility
-    if (!file.is_open()) {
+// Read the records of a FASTA file that have a sequence, at most `limit` of them; none if the file
+// cannot be opened or is damaged gzip data
+vector<FastaPair> readFastaDatabase(const string& filename, size_t limit = SIZE_MAX) {
+    vector<FastaPair> database;
+    FastaReader reader;
+    if (!reader.open(filename)) {
         cerr << "Error opening file: " << filename << endl;
-        return "";
+        return database; 
     }
     
-    string line, sequence = "";
-    string header = "";
-    
-    while (getline(file, line)) {
-        if (line.empty()) continue;
-        
-        line = trim(line); 
-        
-        if (line[0] == '>') {
-            if (!sequence.empty()) {
-                sequences.push_back(sequence); 
-            }
-            headers.push_back(line); 
-            sequence.clear();
-        } else {
-            sequence += line; 
+    FastaRecord record;
+    while (database.size() < limit && reader.next(record)) {
+        if (record.sequence.empty()) continue;
+        FastaPair pair;
+        pair.header.assign(record.header);
+        pair.sequence.assign(record.sequence);
+        database.push_back(std::move(pair));
+    }
+    if (reader.failed()) {
+        // Already reported; a partial database would give wrong results, so treat it as unreadable
+        database.clear();
+    }
+    return database;
+}
+
+// Read the records or regions named in a list file (one per line) through the FASTA's .fai index,
+// in list order, without scanning the rest of the file
+vector<FastaPair> readFastaRegions(const string& filename, const string& listFile) {
+    vector<FastaPair> records;
+    vector<string> regions;
+    if (!readRegionList(listFile, regions)) {
+        cerr << "Error opening file: " << listFile << endl;
+        return records;
+    }
+    IndexedFasta fasta;
+    string error;
+    if (!fasta.open(filename, error)) {
+        cerr << "Error: " << error << endl;
+        return records;
+    }
+    FastaRecord record;
+    for (size_t i = 0; i < regions.size(); i++) {
+        if (!fasta.fetch(regions[i], record, error)) {
+            cerr << "Error: " << error << endl;
+            records.clear();
+            return records;
         }
+        if (record.sequence.empty()) continue;
+        FastaPair pair;
+        pair.header.assign(record.header);
+        pair.sequence.assign(record.sequence);
+        records.push_back(std::move(pair));
     }
-    
-    if (!sequence.empty()) {
-        sequences.push_back(sequence); 
+    return records;
+}
+
+// Fixed-capacity blocking queue between a producer thread and consumer threads
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity), closed(false) {}
+
+    // Blocks while the queue is full
+    void push(T item) {
+        unique_lock<mutex> lock(guard);
+        notFull.wait(lock, [&] { return items.size() < capacity; });
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
     }
-    
-    if (!sequences.empty()) {
-        return sequences[0]; // Return the first sequence for the query
+
+    // Like push, but returns false (leaving `item` untouched) instead of waiting when the queue is full
+    bool tryPush(T& item) {
+        lock_guard<mutex> lock(guard);
+        if (items.size() >= capacity) return false;
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+        return true;
     }
-    
-    return "";
+
+    // Blocks while the queue is empty; returns false once it is closed and drained
+    bool pop(T& item) {
+        unique_lock<mutex> lock(guard);
+        notEmpty.wait(lock, [&] { return !items.empty() || closed; });
+        if (items.empty()) return false;
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        lock_guard<mutex> lock(guard);
+        closed = true;
+        notEmpty.notify_all();
+    }
+
+private:
+    size_t capacity;
+    bool closed;
+    deque<T> items;
+    mutex guard;
+    condition_variable notFull;
+    condition_variable notEmpty;
+};
+
+// Matches printed per query unless --top says otherwise
+const size_t DEFAULT_TOP_COUNT = 5;
+
+// An empty list with the capacity and threshold of `list`, e.g. one per worker thread
+TopList emptyLike(const TopList& list) {
+    return TopList(list.capacity(), list.minimumScore());
 }
 
-// Read a FASTA database
-vector<FastaPair> readFastaDatabase(const string& filename) {
-    ifstream file(filename.c_str()); 
-    if (!file.is_open()) {
-        cerr << "Error opening file: " << filename << endl;
-        vector<FastaPair> empty;
-        return empty; 
+// Merge per-thread top lists into one; the (score, id) order makes the result independent of
+// how work was split between threads
+void mergeTopLists(const vector<TopList>& partialTops, TopList& topProteins) {
+    for (size_t t = 0; t < partialTops.size(); t++) {
+        topProteins.merge(partialTops[t]);
     }
-    
-    string line, sequence = "";
-    vector<FastaPair> database;
-    string header = "";
-    
-    while (getline(file, line)) {
-        if (line.empty()) continue;
-        line = trim(line); 
-        if (line[0] == '>') {
-            if (!sequence.empty()) {
-                FastaPair pair;
-                pair.header = header;
-                pair.sequence = sequence;
-                database.push_back(pair);
-                sequence.clear();
-            }
-            header = line; 
-        } else {
-            sequence += line; 
+}
+
+// Run body(worker, begin, end) over [0, itemCount) in chunks of chunkSize on threadCount threads.
+// Workers claim the next unclaimed chunk from a shared counter, so threads that draw cheap chunks
+// (short proteins) simply take more of them.
+void parallelForChunks(size_t itemCount, size_t chunkSize, unsigned threadCount,
+                       const function<void(unsigned, size_t, size_t)>& body) {
+    atomic<size_t> nextChunk(0);
+    size_t chunkCount = (itemCount + chunkSize - 1) / chunkSize;
+    auto worker = [&](unsigned workerId) {
+        for (size_t chunk = nextChunk++; chunk < chunkCount; chunk = nextChunk++) {
+            size_t begin = chunk * chunkSize;
+            body(workerId, begin, min(itemCount, begin + chunkSize));
         }
+    };
+
+    vector<thread> threads;
+    for (unsigned t = 1; t < threadCount; t++) {
+        threads.push_back(thread(worker, t));
     }
-    if (!sequence.empty()) {
-        FastaPair pair;
-        pair.header = header;
-        pair.sequence = sequence;
-        database.push_back(pair);
+    worker(0);
+    for (size_t t = 0; t < threads.size(); t++) {
+        threads[t].join();
     }
-    return database;
 }
 
-// Insert protein into top proteins array, maintaining sorted order
-void insertIntoTop(vector<ProteinInfo>& topProteins, const ProteinInfo& protein) {
-    // Find position to insert
-    int pos = topProteins.size();
-    for (int i = 0; i < topProteins.size(); i++) {
-        if (protein.jaccardIndex > topProteins[i].jaccardIndex) {
-            pos = i;
-            break;
+// Marks a protein whose k-mer set has no bitmap
+const uint32_t NO_DENSE_SLOT = 0xffffffffu;
+
+// Read-only view of an encoded database and its inverted index. Every array is flat so the same view
+// can point at vectors built in memory or straight into a memory-mapped index file.
+// Identical sequences are stored and scored once: proteins (one per header, numbered in database
+// order) map to unique sequences, and each sequence lists the proteins that share it, so a score is
+// fanned out to every header. Everything below headers is indexed by sequence id.
+// The inverted index maps each k-mer code that occurs in the database to the ids of the sequences
+// containing it; each posting list is stored as LEB128 varint gaps between consecutive (ascending) ids.
+struct DatabaseView {
+    int k;
+    size_t denseWords;              // bitmap words per dense sequence (0 when k has no bitmaps)
+    uint32_t proteinCount;
+    const uint64_t* headerOffsets;  // proteinCount + 1 offsets into headerData
+    const char* headerData;
+    const uint32_t* sequenceIds;    // per protein: its sequence
+    uint32_t sequenceCount;
+    const uint64_t* copyOffsets;    // sequenceCount + 1 offsets into copies
+    const uint32_t* copies;         // proteins sharing each sequence, ascending
+    const uint32_t* lengths;
+    const uint64_t* codeOffsets;    // sequenceCount + 1 offsets into codes
+    const uint32_t* codes;          // each sequence's sorted k-mer codes, back to back
+    const uint32_t* denseSlots;     // per sequence: bitmap number in denseBits, or NO_DENSE_SLOT
+    const uint64_t* denseBits;      // denseWords words per dense sequence
+    uint64_t postingCodeCount;      // distinct codes in the database (0 without an index)
+    const uint32_t* postingCodes;   // those codes, sorted
+    const uint64_t* postingOffsets; // postingCodeCount + 1 byte offsets into postings
+    const uint8_t* postings;
+    const uint32_t* sketches;       // SKETCH_SIZE bottom-k hashes per sequence
+    const uint64_t* residueOffsets; // sequenceCount + 1 offsets into residues
+    const uint8_t* residues;        // each sequence as residue indices, for alignment
+
+    // Header of a protein
+    string_view header(uint32_t protein) const {
+        return string_view(headerData + headerOffsets[protein], headerOffsets[protein + 1] - headerOffsets[protein]);
+    }
+
+    const uint32_t* copiesBegin(uint32_t id) const { return copies + copyOffsets[id]; }
+    const uint32_t* copiesEnd(uint32_t id) const { return copies + copyOffsets[id + 1]; }
+
+    uint32_t setSize(uint32_t id) const { return codeOffsets[id + 1] - codeOffsets[id]; }
+
+    const uint8_t* sequence(uint32_t id) const { return residues + residueOffsets[id]; }
+
+    KmerSpan kmers(uint32_t id) const {
+        KmerSpan span = {codes + codeOffsets[id], setSize(id), NULL};
+        if (denseSlots[id] != NO_DENSE_SLOT) {
+            span.bits = denseBits + uint64_t(denseSlots[id]) * denseWords;
         }
+        return span;
     }
-    
-    // Insert at position
-    if (pos < topProteins.size()) {
-        topProteins.insert(topProteins.begin() + pos, protein);
-        // Remove the last element if size exceeds 15
-        if (topProteins.size() > 15) {
-            topProteins.pop_back();
+
+    // Locate the posting list of a code; empty if no protein contains it
+    void postingList(uint32_t code, const uint8_t*& begin, const uint8_t*& end) const {
+        const uint32_t* slot = lower_bound(postingCodes, postingCodes + postingCodeCount, code);
+        if (slot == postingCodes + postingCodeCount || *slot != code) {
+            begin = end = postings;
+            return;
         }
-    } else if (topProteins.size() < 15) {
-        // If vector isn't full yet, add to the end
-        topProteins.push_back(protein);
+        begin = postings + postingOffsets[slot - postingCodes];
+        end = postings + postingOffsets[slot - postingCodes + 1];
+    }
+};
+
+// Owning storage behind a DatabaseView for databases encoded in this process
+struct DatabaseStorage {
+    int k;
+    vector<uint64_t> headerOffsets;
+    string headerData;
+    vector<uint32_t> sequenceIds;
+    vector<uint64_t> copyOffsets;
+    vector<uint32_t> copies;
+    vector<uint32_t> lengths;
+    vector<uint64_t> codeOffsets;
+    vector<uint32_t> codes;
+    vector<uint32_t> denseSlots;
+    vector<uint64_t> denseBits;
+    vector<uint32_t> postingCodes;
+    vector<uint64_t> postingOffsets;
+    vector<uint8_t> postings;
+    vector<uint32_t> sketches;
+    vector<uint64_t> residueOffsets;
+    vector<uint8_t> residues;
+
+    DatabaseView view() const {
+        DatabaseView v;
+        v.k = k;
+        v.denseWords = bitmapWords(kmerSpace(k));
+        v.proteinCount = sequenceIds.size();
+        v.headerOffsets = headerOffsets.data();
+        v.headerData = headerData.data();
+        v.sequenceIds = sequenceIds.data();
+        v.sequenceCount = lengths.size();
+        v.copyOffsets = copyOffsets.data();
+        v.copies = copies.data();
+        v.lengths = lengths.data();
+        v.codeOffsets = codeOffsets.data();
+        v.codes = codes.data();
+        v.denseSlots = denseSlots.data();
+        v.denseBits = denseBits.data();
+        v.postingCodeCount = postingCodes.size();
+        v.postingCodes = postingCodes.data();
+        v.postingOffsets = postingOffsets.data();
+        v.postings = postings.data();
+        v.sketches = sketches.data();
+        v.residueOffsets = residueOffsets.data();
+        v.residues = residues.data();
+        return v;
     }
+};
+
+// 128-bit hash of a sequence, used to find exact duplicates
+struct SequenceHash {
+    uint64_t low;
+    uint64_t high;
+
+    bool operator==(const SequenceHash& other) const { return low == other.low && high == other.high; }
+};
+
+struct SequenceHashHasher {
+    size_t operator()(const SequenceHash& hash) const { return hash.low; }
+};
+
+// splitmix64 finalizer
+inline uint64_t mix64(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
 }
 
-// Main function
-int main(int argc, char **argv) {
-    if (argc < 3) {
-        cout << "Usage: " << argv[0] << " <query_FASTA_file> <database_FASTA_file>\n";
-        return 0;
+// Two independently seeded lanes over 8-byte words; equal hashes are still confirmed by comparing
+// the sequences themselves
+SequenceHash hashSequence(const string& sequence) {
+    SequenceHash hash = {0x9e3779b97f4a7c15ull ^ sequence.size(), 0xc2b2ae3d27d4eb4full ^ sequence.size()};
+    size_t i = 0;
+    for (; i + 8 <= sequence.size(); i += 8) {
+        uint64_t word;
+        memcpy(&word, sequence.data() + i, 8);
+        hash.low = mix64(hash.low ^ word);
+        hash.high = mix64(hash.high + word * 0xff51afd7ed558ccdull);
     }
+    uint64_t tail = 0;
+    memcpy(&tail, sequence.data() + i, sequence.size() - i);
+    hash.low = mix64(hash.low ^ tail);
+    hash.high = mix64(hash.high + tail * 0xff51afd7ed558ccdull);
+    return hash;
+}
 
-    // Initialize ASCII array for amino acid conversion
-    initializeASCII();
+// Encode every database sequence of sufficient length; protein ids are positions in this order.
+// Exact duplicates are encoded once: a repeated sequence only adds a header and a copy entry.
+template <int K>
+void encodeDatabase(const vector<FastaPair>& database, DatabaseStorage& storage) {
+    storage.k = K;
+    storage.headerOffsets.assign(1, 0);
+    storage.codeOffsets.assign(1, 0);
+    storage.residueOffsets.assign(1, 0);
+    KmerSet kmers;
+    vector<uint8_t> residues;
+    unordered_map<SequenceHash, vector<uint32_t>, SequenceHashHasher> seen; // hash -> sequence ids
+    vector<size_t> firstRecord;                                             // per sequence: record in `database`
+    for (size_t i = 0; i < database.size(); i++) {
+        if (database[i].sequence.length() < MIN_PROTEIN_LENGTH) continue;
 
-    string queryFile = argv[1];
-    string databaseFile = argv[2];
+        storage.headerData += database[i].header;
+        storage.headerOffsets.push_back(storage.headerData.size());
 
-    // Read query file
-    vector<string> queryHeaders;
-    vector<string> querySequences;
-    string querySequence = readFastaFile(queryFile, queryHeaders, querySequences);
-    
-    if (querySequence.empty()) {
-        cerr << "Error: Query sequence is empty or file couldn't be read.\n";
-        return 1;
+        vector<uint32_t>& candidates = seen[hashSequence(database[i].sequence)];
+        size_t match = 0;
+        while (match < candidates.size() && database[firstRecord[candidates[match]]].sequence != database[i].sequence) {
+            match++;
+        }
+        if (match < candidates.size()) {
+            storage.sequenceIds.push_back(candidates[match]);
+            continue;
+        }
+        candidates.push_back(storage.lengths.size());
+        storage.sequenceIds.push_back(storage.lengths.size());
+        firstRecord.push_back(i);
+        storage.lengths.push_back(database[i].sequence.length());
+
+        populateKmerSet<K>(database[i].sequence, kmers);
+        storage.codes.insert(storage.codes.end(), kmers.codes.begin(), kmers.codes.end());
+        storage.codeOffsets.push_back(storage.codes.size());
+        if (kmers.isDense()) {
+            storage.denseSlots.push_back(storage.denseBits.size() / KmerTraits<K>::WORDS);
+            storage.denseBits.insert(storage.denseBits.end(), kmers.bits.begin(), kmers.bits.end());
+        } else {
+            storage.denseSlots.push_back(NO_DENSE_SLOT);
+        }
+        storage.sketches.resize(storage.sketches.size() + SKETCH_SIZE);
+        computeSketch(kmers.codes, &storage.sketches[storage.sketches.size() - SKETCH_SIZE]);
+
+        encodeResidues(database[i].sequence, residues);
+        storage.residues.insert(storage.residues.end(), residues.begin(), residues.end());
+        storage.residueOffsets.push_back(storage.residues.size());
     }
-    
-    // Create and populate query tetramers array
-    bool queryTetramers[21][21][21][21] = {{{{false}}}}; // Initialize all elements to false
-    populateTetramerArray(querySequence, queryTetramers);
 
-    // Read database file
-    vector<FastaPair> database = readFastaDatabase(databaseFile);
-    if (database.empty()) {
-        cerr << "Error: Database is empty or file couldn't be read.\n";
-        return 1;
+    // Group proteins by sequence; proteins are visited in order, so each group comes out ascending
+    storage.copyOffsets.assign(storage.lengths.size() + 1, 0);
+    for (size_t p = 0; p < storage.sequenceIds.size(); p++) {
+        storage.copyOffsets[storage.sequenceIds[p] + 1]++;
+    }
+    for (size_t id = 0; id < storage.lengths.size(); id++) {
+        storage.copyOffsets[id + 1] += storage.copyOffsets[id];
+    }
+    storage.copies.resize(storage.sequenceIds.size());
+    vector<uint64_t> fill(storage.copyOffsets.begin(), storage.copyOffsets.end() - 1);
+    for (size_t p = 0; p < storage.sequenceIds.size(); p++) {
+        storage.copies[fill[storage.sequenceIds[p]]++] = p;
+    }
+}
+
+// Report how many proteins share sequences
+void printDeduplicationStats(const DatabaseView& database) {
+    cerr << "Database: " << database.proteinCount << " proteins, " << database.sequenceCount
+         << " unique sequences (dedup ratio " << fixed << setprecision(3)
+         << (database.sequenceCount == 0 ? 1.0 : (double)(database.proteinCount) / database.sequenceCount)
+         << ")\n";
+}
+
+// Append an unsigned integer as a LEB128 varint
+void appendVarint(vector<uint8_t>& out, uint32_t value) {
+    while (value >= 0x80) {
+        out.push_back(uint8_t(value) | 0x80);
+        value >>= 7;
     }
+    out.push_back(uint8_t(value));
+}
 
-    // Vector to store top proteins
-    vector<ProteinInfo> topProteins;
-    for (int i = 0; i < 15; i++) {
-        ProteinInfo protein;
-        protein.jaccardIndex = -1; // Initialize with invalid value
-        topProteins.push_back(protein);
+// Decode one LEB128 varint and advance the cursor
+inline uint32_t readVarint(const uint8_t*& cursor) {
+    uint32_t value = *cursor & 0x7f;
+    int shift = 7;
+    while (*cursor++ & 0x80) {
+        value |= uint32_t(*cursor & 0x7f) << shift;
+        shift += 7;
     }
+    return value;
+}
 
-    // Process each database sequence
-    for (int i = 0; i < database.size(); i++) {
-        string header = database[i].header;
-        string dbSequence = database[i].sequence;
-        
-        // Only process sequences of sufficient length
-        if (dbSequence.length() >= 100) {
-            bool dbTetramers[21][21][21][21] = {{{{false}}}}; // Initialize all elements to false
-            populateTetramerArray(dbSequence, dbTetramers);
+// Build the inverted index. Small code spaces use a counting sort over (code, sequence id) pairs;
+// for k >= 5 a table over the whole code space would be too large, so the pairs are sorted instead.
+// Either way only codes that occur get a posting list.
+void buildInvertedIndex(DatabaseStorage& storage) {
+    size_t sequenceCount = storage.lengths.size();
+    uint64_t space = kmerSpace(storage.k);
+    vector<uint32_t> codes;        // code of each posting, grouped
+    vector<uint32_t> ids;          // sequence id of each posting, ascending within a code
+
+    if (space <= MAX_DENSE_SPACE) {
+        vector<uint64_t> listStart(space + 1, 0);
+        for (size_t i = 0; i < storage.codes.size(); i++) {
+            listStart[storage.codes[i] + 1]++;
+        }
+        for (uint64_t code = 0; code < space; code++) {
+            listStart[code + 1] += listStart[code];
+        }
 
-            double jaccardIndex = calculateJaccardIndex(queryTetramers, dbTetramers);
-            
-            // Create protein info structure
-            ProteinInfo protein;
-            protein.name = header;
-            protein.length = dbSequence.length();
-            protein.jaccardIndex = jaccardIndex;
-            
-            // Insert into top proteins
-            insertIntoTop(topProteins, protein);
+        // Sequences are visited in id order, so every posting list comes out sorted
+        codes.resize(storage.codes.size());
+        ids.resize(storage.codes.size());
+        vector<uint64_t> fill(listStart.begin(), listStart.end() - 1);
+        for (size_t id = 0; id < sequenceCount; id++) {
+            for (uint64_t k = storage.codeOffsets[id]; k < storage.codeOffsets[id + 1]; k++) {
+                uint64_t slot = fill[storage.codes[k]]++;
+                codes[slot] = storage.codes[k];
+                ids[slot] = id;
+            }
+        }
+    } else {
+        vector<uint64_t> pairs;
+        pairs.reserve(storage.codes.size());
+        for (size_t id = 0; id < sequenceCount; id++) {
+            for (uint64_t k = storage.codeOffsets[id]; k < storage.codeOffsets[id + 1]; k++) {
+                pairs.push_back(uint64_t(storage.codes[k]) << 32 | id);
+            }
+        }
+        sort(pairs.begin(), pairs.end());
+        codes.resize(pairs.size());
+        ids.resize(pairs.size());
+        for (size_t i = 0; i < pairs.size(); i++) {
+            codes[i] = pairs[i] >> 32;
+            ids[i] = uint32_t(pairs[i]);
         }
     }
 
-    // Print results
-    cout << "Query file: " << queryFile << endl;
-    cout << "Database file: " << databaseFile << endl << endl;
-    
-    cout << "Top 5 matches by tetrapeptide Jaccard similarity:\n";
-    cout << "Rank\tJaccard similarity\tLength\tProtein\n";
-    
-    for (int i = 0; i < 5; i++) {
-        if (topProteins[i].jaccardIndex >= 0) {
-            cout << i + 1 << "\t"
-                 << fixed << setprecision(7) << topProteins[i].jaccardIndex << "\t"
-                 << topProteins[i].length << "\t"
-                 << topProteins[i].name << "\n";
+    storage.postingCodes.clear();
+    storage.postingOffsets.clear();
+    storage.postings.clear();
+    storage.postings.reserve(ids.size() + ids.size() / 4);
+    uint32_t previous = 0;
+    for (size_t i = 0; i < ids.size(); i++) {
+        if (i == 0 || codes[i] != codes[i - 1]) {
+            storage.postingCodes.push_back(codes[i]);
+            storage.postingOffsets.push_back(storage.postings.size());
+            previous = 0;
         }
+        appendVarint(storage.postings, ids[i] - previous);
+        previous = ids[i];
     }
+    storage.postingOffsets.push_back(storage.postings.size());
+}
 
-    return 0;
-}
\ No newline at end of file
+// Proteins (or query codes) handed to a worker at a time
+const size_t SCAN_CHUNK_SIZE = 256;
+
+// Offer a scored sequence to a top list under each protein that shares it. Copies are in ascending
+// order, so once one misses the cut the rest do too.
+void offerSequence(const DatabaseView& database, uint32_t id, double score, TopList& topProteins) {
+    for (const uint32_t* copy = database.copiesBegin(id); copy < database.copiesEnd(id); copy++) {
+        if (!topProteins.accepts(score, *copy)) return;
+
+        ProteinInfo protein = {database.header(*copy), (int)database.lengths[id]};
+        topProteins.offer(score, *copy, protein);
+    }
+}
+
+// Database ids ordered by decreasing Jaccard upper bound against a query with `querySize` k-mers:
+// proteins are sorted by set size, then taken outward from |Q| in both directions. Anything after
+// the first candidate whose bound falls below the current K-th best score can be skipped.
+vector<uint32_t> candidatesByBound(const DatabaseView& database, size_t querySize) {
+    vector<pair<size_t, uint32_t> > bySize(database.sequenceCount);
+    for (uint32_t id = 0; id < database.sequenceCount; id++) {
+        bySize[id] = make_pair(database.setSize(id), id);
+    }
+    sort(bySize.begin(), bySize.end());
+
+    vector<uint32_t> order;
+    order.reserve(bySize.size());
+    size_t above = lower_bound(bySize.begin(), bySize.end(), make_pair(querySize, uint32_t(0))) - bySize.begin();
+    size_t below = above; // next candidate smaller than |Q| is below - 1
+    while (below > 0 || above < bySize.size()) {
+        bool takeAbove = below == 0 || (above < bySize.size() && jaccardUpperBound(querySize, bySize[above].first)
+                                                                >= jaccardUpperBound(querySize, bySize[below - 1].first));
+        order.push_back(takeAbove ? bySize[above++].second : bySize[--below].second);
+    }
+    return order;
+}
+
+// Score every protein at once: walk only the postings of the query's own k-mers to count
+// intersections, then derive each union as |Q| + |D| - I.
+// With several threads each worker counts into its own array over a share of the query codes;
+// the arrays are summed while scoring, which is itself split across the workers.
+void searchInvertedIndex(const DatabaseView& database, const KmerSet& queryKmers,
+                         unsigned threadCount, TopList& topProteins) {
+    const vector<uint32_t>& queryCodes = queryKmers.codes;
+    vector<vector<uint32_t> > intersections(threadCount, vector<uint32_t>(database.sequenceCount, 0));
+
+    parallelForChunks(queryCodes.size(), SCAN_CHUNK_SIZE, threadCount,
+                      [&](unsigned worker, size_t begin, size_t end) {
+        vector<uint32_t>& counts = intersections[worker];
+        for (size_t i = begin; i < end; i++) {
+            const uint8_t* cursor;
+            const uint8_t* last;
+            database.postingList(queryCodes[i], cursor, last);
+            uint32_t id = 0;
+            while (cursor < last) {
+                id += readVarint(cursor);
+                counts[id]++;
+            }
+        }
+    });
+
+    vector<TopList> partialTops(threadCount, emptyLike(topProteins));
+    parallelForChunks(database.sequenceCount, SCAN_CHUNK_SIZE * 16, threadCount,
+                      [&](unsigned worker, size_t begin, size_t end) {
+        for (uint32_t id = begin; id < end; id++) {
+            size_t intersection = 0;
+            for (unsigned t = 0; t < threadCount; t++) {
+                intersection += intersections[t][id];
+            }
+            size_t unionCount = queryCodes.size() + database.setSize(id) - intersection;
+            double score = unionCount == 0 ? 0.0 : (double)(intersection) / unionCount;
+            offerSequence(database, id, score, partialTops[worker]);
+        }
+    });
+    mergeTopLists(partialTops, topProteins);
+}
+
+// Score proteins independently with calculateJaccardIndex, each worker keeping its own top list.
+// Candidates come in order of decreasing upper bound, so a worker stops a chunk at the first one
+// that cannot beat its K-th best and cuts a merge short once it cannot reach that score. A worker's
+// K-th best never exceeds the final one, so nothing that belongs in the final list is skipped.
+template <int K>
+void searchPairwise(const DatabaseView& database, const KmerSet& queryKmers,
+                    unsigned threadCount, TopList& topProteins) {
+    KmerSpan query = spanOf(queryKmers);
+    vector<uint32_t> candidates = candidatesByBound(database, query.size);
+    vector<TopList> partialTops(threadCount, emptyLike(topProteins));
+
+    parallelForChunks(candidates.size(), SCAN_CHUNK_SIZE, threadCount,
+                      [&](unsigned worker, size_t begin, size_t end) {
+        TopList& top = partialTops[worker];
+        for (size_t i = begin; i < end; i++) {
+            uint32_t id = candidates[i];
+            KmerSpan dbKmers = database.kmers(id);
+            if (jaccardUpperBound(query.size, dbKmers.size) < top.floor()) break;
+
+            double score = calculateJaccardIndex<K>(query, dbKmers, top.floor());
+            offerSequence(database, id, score, top);
+        }
+    });
+    mergeTopLists(partialTops, topProteins);
+}
+
+// Sketch prefilter: estimate every protein's Jaccard from bottom-k sketches alone, shortlist the
+// `shortlistSize` best estimates, and compute exact Jaccard only for the shortlist. Only the sketches
+// and the shortlisted proteins' code lists are ever touched.
+template <int K>
+void searchWithSketches(const DatabaseView& database, const KmerSet& queryKmers, size_t shortlistSize,
+                        unsigned threadCount, TopList& topProteins) {
+    vector<uint32_t> querySketch(SKETCH_SIZE);
+    computeSketch(queryKmers.codes, querySketch.data());
+
+    vector<float> estimates(database.sequenceCount);
+    parallelForChunks(database.sequenceCount, SCAN_CHUNK_SIZE * 16, threadCount,
+                      [&](unsigned, size_t begin, size_t end) {
+        for (size_t id = begin; id < end; id++) {
+            estimates[id] = estimateJaccardIndex(querySketch.data(), database.sketches + id * SKETCH_SIZE);
+        }
+    });
+
+    vector<uint32_t> shortlist(database.sequenceCount);
+    for (uint32_t id = 0; id < database.sequenceCount; id++) {
+        shortlist[id] = id;
+    }
+    if (shortlistSize < shortlist.size()) {
+        nth_element(shortlist.begin(), shortlist.begin() + shortlistSize, shortlist.end(),
+                    [&](uint32_t a, uint32_t b) {
+            return estimates[a] != estimates[b] ? estimates[a] > estimates[b] : a < b;
+        });
+        shortlist.resize(shortlistSize);
+    }
+
+    // Exact re-rank of the survivors, with the same bound pruning as searchPairwise
+    KmerSpan query = spanOf(queryKmers);
+    vector<TopList> partialTops(threadCount, emptyLike(topProteins));
+    parallelForChunks(shortlist.size(), SCAN_CHUNK_SIZE, threadCount, [&](unsigned worker, size_t begin, size_t end) {
+        TopList& top = partialTops[worker];
+        for (size_t i = begin; i < end; i++) {
+            uint32_t id = shortlist[i];
+            KmerSpan dbKmers = database.kmers(id);
+            if (jaccardUpperBound(query.size, dbKmers.size) < top.floor()) continue;
+
+            double score = calculateJaccardIndex<K>(query, dbKmers, top.floor());
+            offerSequence(database, id, score, top);
+        }
+    });
+    mergeTopLists(partialTops, topProteins);
+}
+
+// Queries scored together against each database protein; the tile's own inverted index and its
+// per-query counters stay in cache while the database streams past
+const size_t QUERY_TILE_SIZE = 64;
+// Bits in a tile's code filter. Codes are hashed into it, so its size does not depend on k.
+const uint32_t TILE_FILTER_BITS = 1 << 18;
+
+// Inverted index over one tile of queries: for each code present in any of them, which queries have it
+struct QueryTile {
+    size_t firstQuery;
+    vector<uint32_t> setSizes;  // |Q| per query in the tile
+    uint32_t minSetSize;        // smallest and largest |Q| in the tile
+    uint32_t maxSetSize;
+    vector<uint64_t> filter;    // hashed bitmap of every code in the tile, rejects most database codes cheaply
+    vector<uint32_t> codes;     // distinct codes, sorted
+    vector<uint32_t> offsets;   // codes.size() + 1 offsets into members
+    vector<uint16_t> members;   // tile-local query numbers
+};
+
+// Slot of a code in a tile's filter
+inline uint32_t tileFilterSlot(uint32_t code) {
+    return hashKmerCode(code) & (TILE_FILTER_BITS - 1);
+}
+
+// Build the tile for queries [begin, end); `queryAt(q)` returns the KmerSpan of query q
+template <typename SpanFunction>
+QueryTile buildQueryTile(SpanFunction queryAt, size_t begin, size_t end) {
+    QueryTile tile;
+    tile.firstQuery = begin;
+    tile.filter.assign(TILE_FILTER_BITS / 64, 0);
+    tile.minSetSize = UINT32_MAX;
+    tile.maxSetSize = 0;
+
+    vector<pair<uint32_t, uint16_t> > postings;
+    for (size_t q = begin; q < end; q++) {
+        KmerSpan query = queryAt(q);
+        tile.setSizes.push_back(query.size);
+        tile.minSetSize = min<uint32_t>(tile.minSetSize, query.size);
+        tile.maxSetSize = max<uint32_t>(tile.maxSetSize, query.size);
+        for (size_t i = 0; i < query.size; i++) {
+            postings.push_back(make_pair(query.codes[i], uint16_t(q - begin)));
+            uint32_t slot = tileFilterSlot(query.codes[i]);
+            tile.filter[slot >> 6] |= uint64_t(1) << (slot & 63);
+        }
+    }
+    sort(postings.begin(), postings.end());
+
+    for (size_t i = 0; i < postings.size(); i++) {
+        if (tile.codes.empty() || tile.codes.back() != postings[i].first) {
+            tile.codes.push_back(postings[i].first);
+            tile.offsets.push_back(tile.members.size());
+        }
+        tile.members.push_back(postings[i].second);
+    }
+    tile.offsets.push_back(tile.members.size());
+    return tile;
+}
+
+QueryTile buildQueryTile(const vector<KmerSet>& queries, size_t begin, size_t end) {
+    return buildQueryTile([&](size_t q) { return spanOf(queries[q]); }, begin, end);
+}
+
+// Count the intersections of one database protein's codes with every query in a tile
+void countTileIntersections(const QueryTile& tile, const KmerSpan& dbKmers, vector<uint32_t>& intersections) {
+    intersections.assign(tile.setSizes.size(), 0);
+
+    const uint32_t* tileCodes = tile.codes.data();
+    const uint32_t* tileEnd = tileCodes + tile.codes.size();
+    const uint32_t* position = tileCodes;
+    for (size_t i = 0; i < dbKmers.size; i++) {
+        uint32_t code = dbKmers.codes[i];
+        uint32_t filterSlot = tileFilterSlot(code);
+        if (!((tile.filter[filterSlot >> 6] >> (filterSlot & 63)) & 1)) continue;
+        // Database codes are sorted too, so the search resumes where the last one ended
+        position = lower_bound(position, tileEnd, code);
+        // The filter is hashed, so a code can pass it without being in the tile
+        if (position == tileEnd || *position != code) continue;
+        size_t slot = position - tileCodes;
+        for (uint32_t m = tile.offsets[slot]; m < tile.offsets[slot + 1]; m++) {
+            intersections[tile.members[m]]++;
+        }
+    }
+}
+
+// Highest Jaccard index any query of the tile can reach against a set of `setSize` k-mers
+double tileUpperBound(const QueryTile& tile, size_t setSize) {
+    if (setSize < tile.minSetSize) return jaccardUpperBound(setSize, tile.minSetSize);
+    if (setSize > tile.maxSetSize) return jaccardUpperBound(setSize, tile.maxSetSize);
+    return 1.0;
+}
+
+// True if a database protein with `setSize` k-mers could still enter some query's top list in the
+// tile; if not, its intersections need not be counted at all
+bool tileCanQualify(const QueryTile& tile, size_t setSize, uint32_t id, const vector<TopList>& tops) {
+    for (size_t q = 0; q < tile.setSizes.size(); q++) {
+        if (tops[tile.firstQuery + q].accepts(jaccardUpperBound(tile.setSizes[q], setSize), id)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Offer one database sequence to the top lists of every query in a tile, under each of the proteins
+// [copies, copiesEnd) that share it. `header(id)` is only called for proteins that make a cut, so
+// a streaming search only sets aside the headers it may print.
+template <typename HeaderFunction>
+void offerToTileTops(const QueryTile& tile, size_t dbSetSize, const vector<uint32_t>& intersections,
+                     const uint32_t* copies, const uint32_t* copiesEnd, int length, HeaderFunction header,
+                     vector<TopList>& tops) {
+    for (size_t q = 0; q < intersections.size(); q++) {
+        size_t unionCount = tile.setSizes[q] + dbSetSize - intersections[q];
+        double score = unionCount == 0 ? 0.0 : (double)(intersections[q]) / unionCount;
+        TopList& topProteins = tops[tile.firstQuery + q];
+        for (const uint32_t* copy = copies; copy < copiesEnd; copy++) {
+            if (!topProteins.accepts(score, *copy)) break;
+
+            ProteinInfo protein = {header(*copy), length};
+            topProteins.offer(score, *copy, protein);
+        }
+    }
+}
+
+// Batch search: every query against every database protein. Each worker takes a tile of queries and
+// walks the database once, probing the tile's index with each protein's codes to count the
+// intersections with all of the tile's queries at once. Every query's list starts as a copy of `emptyList`.
+void searchBatch(const DatabaseView& database, const vector<KmerSet>& queries, unsigned threadCount,
+                 const TopList& emptyList, vector<TopList>& tops) {
+    tops.assign(queries.size(), emptyList);
+
+    // Smaller tiles when there are few queries, so every thread still gets one
+    size_t tileSize = min(QUERY_TILE_SIZE, max<size_t>(1, (queries.size() + threadCount - 1) / threadCount));
+
+    parallelForChunks(queries.size(), tileSize, threadCount, [&](unsigned, size_t begin, size_t end) {
+        QueryTile tile = buildQueryTile(queries, begin, end);
+        vector<uint32_t> intersections;
+
+        for (uint32_t id = 0; id < database.sequenceCount; id++) {
+            KmerSpan dbKmers = database.kmers(id);
+            if (!tileCanQualify(tile, dbKmers.size, *database.copiesBegin(id), tops)) continue;
+            countTileIntersections(tile, dbKmers, intersections);
+            offerToTileTops(tile, dbKmers.size, intersections, database.copiesBegin(id), database.copiesEnd(id),
+                            database.lengths[id], [&](uint32_t protein) { return database.header(protein); }, tops);
+        }
+    });
+}
+
+// Sequence bytes per chunk handed from the streaming reader to the scorers
+const size_t STREAM_CHUNK_BYTES = 1 << 20;
+// Chunks allowed in flight per scorer thread; bounds memory to a few MB per thread
+const size_t STREAM_CHUNKS_PER_THREAD = 2;
+
+// A run of consecutive database proteins handed from the reader thread to the scorers
+struct RecordChunk {
+    uint32_t firstId;
+    vector<FastaPair> records;
+};
+
+// Streaming search: a reader thread parses the database FASTA into chunks and feeds them through a
+// bounded queue to scorer threads, which encode, score and discard each chunk. Memory stays bounded
+// by the queue no matter how large the database is, and parsing overlaps with scoring. The headers
+// of proteins that enter a top list are kept in `headerStore`, which must outlive `tops`.
+// Returns false if the database cannot be opened, is damaged gzip data or holds no proteins.
+template <int K>
+bool searchStreaming(const string& databaseFile, const vector<KmerSet>& queries, unsigned threadCount,
+                     const TopList& emptyList, vector<TopList>& tops, vector<deque<string> >& headerStore) {
+    FastaReader reader;
+    if (!reader.open(databaseFile)) {
+        cerr << "Error opening file: " << databaseFile << endl;
+        return false;
+    }
+
+    vector<QueryTile> tiles;
+    for (size_t begin = 0; begin < queries.size(); begin += QUERY_TILE_SIZE) {
+        tiles.push_back(buildQueryTile(queries, begin, min(queries.size(), begin + QUERY_TILE_SIZE)));
+    }
+
+    BoundedQueue<RecordChunk> queue(STREAM_CHUNKS_PER_THREAD * threadCount);
+    uint32_t proteinCount = 0;
+    thread producer([&] {
+        RecordChunk chunk;
+        chunk.firstId = 0;
+        size_t chunkBytes = 0;
+        FastaRecord record;
+        while (reader.next(record)) {
+            if (record.sequence.length() < MIN_PROTEIN_LENGTH) continue;
+            chunkBytes += record.sequence.size();
+            chunk.records.push_back(FastaPair());
+            chunk.records.back().header.assign(record.header);
+            chunk.records.back().sequence.assign(record.sequence);
+            if (chunkBytes >= STREAM_CHUNK_BYTES) {
+                proteinCount += chunk.records.size();
+                queue.push(std::move(chunk));
+                chunk = RecordChunk();
+                chunk.firstId = proteinCount;
+                chunkBytes = 0;
+            }
+        }
+        if (!chunk.records.empty()) {
+            proteinCount += chunk.records.size();
+            queue.push(std::move(chunk));
+        }
+        queue.close();
+    });
+
+    vector<vector<TopList> > partialTops(threadCount, vector<TopList>(queries.size(), emptyList));
+    headerStore.assign(threadCount, deque<string>());
+    vector<thread> scorers;
+    for (unsigned t = 0; t < threadCount; t++) {
+        scorers.push_back(thread([&, t] {
+            RecordChunk chunk;
+            KmerSet dbKmers;
+            vector<uint32_t> intersections;
+            while (queue.pop(chunk)) {
+                for (size_t r = 0; r < chunk.records.size(); r++) {
+                    const FastaPair& record = chunk.records[r];
+                    encodeKmerCodes<K>(record.sequence, dbKmers.codes);
+                    KmerSpan span = spanOf(dbKmers);
+                    for (size_t k = 0; k < tiles.size(); k++) {
+                        if (!tileCanQualify(tiles[k], span.size, chunk.firstId + r, partialTops[t])) continue;
+                        countTileIntersections(tiles[k], span, intersections);
+                        uint32_t id = chunk.firstId + r;
+                        offerToTileTops(tiles[k], span.size, intersections, &id, &id + 1, record.sequence.length(),
+                                        [&](uint32_t) {
+                            headerStore[t].push_back(record.header);
+                            return string_view(headerStore[t].back());
+                        }, partialTops[t]);
+                    }
+                }
+            }
+        }));
+    }
+    producer.join();
+    for (size_t t = 0; t < scorers.size(); t++) {
+        scorers[t].join();
+    }
+
+    if (proteinCount == 0 || reader.failed()) {
+        return false;
+    }
+    tops.assign(queries.size(), emptyList);
+    for (size_t q = 0; q < queries.size(); q++) {
+        for (unsigned t = 0; t < threadCount; t++) {
+            tops[q].merge(partialTops[t][q]);
+        }
+    }
+    return true;
+}
+
+// Print the best `count` matches in the tool's standard table
+void printTopMatches(ostream& out, const vector<Match>& matches, size_t count, int k) {
+    out << "Top " << count << " matches by " << peptideName(k) << " Jaccard similarity:\n";
+    out << "Rank\tJaccard similarity\tLength\tProtein\n";
+    
+    for (size_t i = 0; i < matches.size() && i < count; i++) {
+        out << i + 1 << "\t"
+            << fixed << setprecision(7) << matches[i].score << "\t"
+            << matches[i].payload.length << "\t"
+            << matches[i].payload.name << "\n";
+    }
+}
+
+// Align the query against the first `alignCount` of its matches, on all threads; scores follow
+// the order of the matches
+void alignTopMatches(const DatabaseView& database, const vector<uint8_t>& queryResidues,
+                     const vector<Match>& matches, size_t alignCount, unsigned threadCount,
+                     vector<int>& alignmentScores) {
+    AlignmentProfile profile;
+    buildAlignmentProfile(queryResidues, profile);
+    size_t count = min(alignCount, matches.size());
+    alignmentScores.assign(count, -1);
+    parallelForChunks(count, 1, threadCount, [&](unsigned, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            uint32_t id = database.sequenceIds[matches[i].key];
+            alignmentScores[i] = smithWatermanScore(profile, database.sequence(id), database.lengths[id]);
+        }
+    });
+}
+
+// Print the best `count` aligned candidates re-ranked by alignment score, with their Jaccard
+// similarity alongside; equal scores keep their Jaccard order
+void printAlignedMatches(ostream& out, const vector<Match>& matches, const vector<int>& alignmentScores,
+                         size_t count, int k) {
+    vector<size_t> order;
+    for (size_t i = 0; i < alignmentScores.size(); i++) {
+        if (alignmentScores[i] >= 0) order.push_back(i);
+    }
+    stable_sort(order.begin(), order.end(),
+                [&](size_t a, size_t b) { return alignmentScores[a] > alignmentScores[b]; });
+
+    out << "Top " << count << " of " << order.size() << " best " << peptideName(k)
+        << " Jaccard matches by Smith-Waterman score (BLOSUM62, gap open " << GAP_OPEN
+        << ", extend " << GAP_EXTEND << "):\n";
+    out << "Rank\tAlignment score\tJaccard similarity\tLength\tProtein\n";
+    for (size_t i = 0; i < order.size() && i < count; i++) {
+        const Match& match = matches[order[i]];
+        out << i + 1 << "\t"
+            << alignmentScores[order[i]] << "\t"
+            << fixed << setprecision(7) << match.score << "\t"
+            << match.payload.length << "\t"
+            << match.payload.name << "\n";
+    }
+}
+
+// Align each query's best matches if `alignCount` is set, then print the result tables of every
+// query: `count` Jaccard matches, or as many alignment re-ranked ones. Batch output labels each
+// table with its query header.
+void printResults(ostream& out, const DatabaseView& database, const vector<FastaPair>& queryRecords,
+                  const vector<TopList>& tops, size_t alignCount, unsigned threadCount, bool batchMode,
+                  size_t count, int k) {
+    vector<uint8_t> queryResidues;
+    vector<int> alignmentScores;
+    for (size_t q = 0; q < tops.size(); q++) {
+        vector<Match> matches = tops[q].sorted();
+        if (batchMode) {
+            out << "Query: " << queryRecords[q].header << "\n";
+        }
+        if (alignCount > 0) {
+            encodeResidues(queryRecords[q].sequence, queryResidues);
+            alignTopMatches(database, queryResidues, matches, alignCount, threadCount, alignmentScores);
+            printAlignedMatches(out, matches, alignmentScores, count, k);
+        } else {
+            printTopMatches(out, matches, count, k);
+        }
+        if (batchMode) {
+            out << "\n";
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------------------
+// Persistent index file
+//
+// Layout: IndexFileHeader, then sectionCount IndexSection entries, then the sections themselves,
+// each starting on a 64-byte boundary. Every section is a flat array from DatabaseStorage, so a
+// mapped file can be used in place without any parsing. Integers are stored in native byte order;
+// byteOrderMark rejects files written on a machine with a different one.
+// ---------------------------------------------------------------------------------------------
+
+const char INDEX_MAGIC[8] = {'T', 'E', 'T', 'R', 'A', 'I', 'D', 'X'};
+const uint32_t INDEX_VERSION = 5; // 2: bottom-k sketches, 3: any k, posting directory, 4: residues, 5: dedup
+const uint32_t INDEX_BYTE_ORDER_MARK = 0x01020304;
+const uint64_t INDEX_ALIGNMENT = 64;
+
+enum IndexSectionTag {
+    SECTION_HEADER_OFFSETS = 1,
+    SECTION_HEADER_DATA,
+    SECTION_LENGTHS,
+    SECTION_CODE_OFFSETS,
+    SECTION_CODES,
+    SECTION_DENSE_SLOTS,
+    SECTION_DENSE_BITS,
+    SECTION_POSTING_OFFSETS,
+    SECTION_POSTINGS,
+    SECTION_SOURCE_PATH,
+    SECTION_SKETCHES,
+    SECTION_POSTING_CODES,
+    SECTION_RESIDUE_OFFSETS,
+    SECTION_RESIDUES,
+    SECTION_SEQUENCE_IDS,
+    SECTION_COPY_OFFSETS,
+    SECTION_COPIES
+};
+
+struct IndexFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrderMark;
+    uint32_t proteinCount;
+    uint32_t sectionCount;
+    uint32_t k;              // peptide length the database was encoded with
+    uint32_t sequenceCount;  // unique sequences among the proteins
+    uint64_t sourceSize;     // size in bytes of the FASTA the index was built from
+    int64_t sourceModified;  // its modification time (seconds since the epoch)
+    uint64_t sourceChecksum; // FNV-1a 64 over its bytes
+};
+
+struct IndexSection {
+    uint32_t tag;
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t size;
+};
+
+// Size, modification time and checksum of the source FASTA
+struct SourceInfo {
+    uint64_t size;
+    int64_t modified;
+    uint64_t checksum;
+};
+
+// FNV-1a 64-bit checksum of a whole file, read in large blocks
+bool checksumFile(const string& filename, SourceInfo& info) {
+    ifstream file(filename.c_str(), ios::binary);
+    struct stat status;
+    if (!file.is_open() || stat(filename.c_str(), &status) != 0) {
+        return false;
+    }
+    info.size = status.st_size;
+    info.modified = status.st_mtime;
+    info.checksum = 14695981039346656037ull;
+
+    vector<char> block(1 << 20);
+    while (file.read(block.data(), block.size()) || file.gcount() > 0) {
+        streamsize count = file.gcount();
+        for (streamsize i = 0; i < count; i++) {
+            info.checksum = (info.checksum ^ (unsigned char)block[i]) * 1099511628211ull;
+        }
+    }
+    return true;
+}
+
+// Write the encoded database and its inverted index as a versioned index file
+bool writeIndexFile(const string& filename, const DatabaseStorage& storage, const SourceInfo& source,
+                    const string& sourcePath) {
+    struct SectionData {
+        uint32_t tag;
+        const void* data;
+        uint64_t size;
+    };
+    SectionData sections[] = {
+        {SECTION_HEADER_OFFSETS, storage.headerOffsets.data(), storage.headerOffsets.size() * sizeof(uint64_t)},
+        {SECTION_HEADER_DATA, storage.headerData.data(), storage.headerData.size()},
+        {SECTION_LENGTHS, storage.lengths.data(), storage.lengths.size() * sizeof(uint32_t)},
+        {SECTION_CODE_OFFSETS, storage.codeOffsets.data(), storage.codeOffsets.size() * sizeof(uint64_t)},
+        {SECTION_CODES, storage.codes.data(), storage.codes.size() * sizeof(uint32_t)},
+        {SECTION_DENSE_SLOTS, storage.denseSlots.data(), storage.denseSlots.size() * sizeof(uint32_t)},
+        {SECTION_DENSE_BITS, storage.denseBits.data(), storage.denseBits.size() * sizeof(uint64_t)},
+        {SECTION_POSTING_CODES, storage.postingCodes.data(), storage.postingCodes.size() * sizeof(uint32_t)},
+        {SECTION_POSTING_OFFSETS, storage.postingOffsets.data(), storage.postingOffsets.size() * sizeof(uint64_t)},
+        {SECTION_POSTINGS, storage.postings.data(), storage.postings.size()},
+        {SECTION_SOURCE_PATH, sourcePath.data(), sourcePath.size()},
+        {SECTION_SKETCHES, storage.sketches.data(), storage.sketches.size() * sizeof(uint32_t)},
+        {SECTION_RESIDUE_OFFSETS, storage.residueOffsets.data(), storage.residueOffsets.size() * sizeof(uint64_t)},
+        {SECTION_RESIDUES, storage.residues.data(), storage.residues.size()},
+        {SECTION_SEQUENCE_IDS, storage.sequenceIds.data(), storage.sequenceIds.size() * sizeof(uint32_t)},
+        {SECTION_COPY_OFFSETS, storage.copyOffsets.data(), storage.copyOffsets.size() * sizeof(uint64_t)},
+        {SECTION_COPIES, storage.copies.data(), storage.copies.size() * sizeof(uint32_t)}
+    };
+    const uint32_t sectionCount = sizeof(sections) / sizeof(sections[0]);
+
+    IndexFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    header.version = INDEX_VERSION;
+    header.byteOrderMark = INDEX_BYTE_ORDER_MARK;
+    header.proteinCount = storage.sequenceIds.size();
+    header.sectionCount = sectionCount;
+    header.k = storage.k;
+    header.sequenceCount = storage.lengths.size();
+    header.sourceSize = source.size;
+    header.sourceModified = source.modified;
+    header.sourceChecksum = source.checksum;
+
+    vector<IndexSection> table(sectionCount);
+    uint64_t offset = sizeof(header) + sectionCount * sizeof(IndexSection);
+    for (uint32_t i = 0; i < sectionCount; i++) {
+        offset = (offset + INDEX_ALIGNMENT - 1) / INDEX_ALIGNMENT * INDEX_ALIGNMENT;
+        table[i].tag = sections[i].tag;
+        table[i].reserved = 0;
+        table[i].offset = offset;
+        table[i].size = sections[i].size;
+        offset += sections[i].size;
+    }
+
+    ofstream file(filename.c_str(), ios::binary | ios::trunc);
+    if (!file.is_open()) {
+        cerr << "Error opening file: " << filename << endl;
+        return false;
+    }
+    file.write((const char*)&header, sizeof(header));
+    file.write((const char*)table.data(), table.size() * sizeof(IndexSection));
+    const char padding[INDEX_ALIGNMENT] = {0};
+    uint64_t position = sizeof(header) + sectionCount * sizeof(IndexSection);
+    for (uint32_t i = 0; i < sectionCount; i++) {
+        file.write(padding, table[i].offset - position);
+        file.write((const char*)sections[i].data, sections[i].size);
+        position = table[i].offset + sections[i].size;
+    }
+    file.close();
+    if (!file) {
+        cerr << "Error writing file: " << filename << endl;
+        return false;
+    }
+    return true;
+}
+
+// A read-only memory-mapped index file. The mapping is shared, so concurrent query processes on the
+// same node all use the same page-cache pages.
+class MappedIndex {
+public:
+    MappedIndex() : base(NULL), size(0) {}
+    ~MappedIndex() {
+        if (base != NULL) munmap(base, size);
+    }
+
+    // Map the file and point `database` into it; on failure fills `error` and returns false
+    bool open(const string& filename, DatabaseView& database, string& error) {
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            error = "cannot open " + filename;
+            return false;
+        }
+        struct stat status;
+        if (fstat(fd, &status) != 0 || (uint64_t)status.st_size < sizeof(IndexFileHeader)) {
+            ::close(fd);
+            error = "file too small to be an index";
+            return false;
+        }
+        size = status.st_size;
+        void* mapping = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED) {
+            error = "mmap failed";
+            return false;
+        }
+        base = (char*)mapping;
+
+        memcpy(&header, base, sizeof(header));
+        if (memcmp(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0) {
+            error = "not an index file";
+            return false;
+        }
+        if (header.byteOrderMark != INDEX_BYTE_ORDER_MARK) {
+            error = "index was written with a different byte order";
+            return false;
+        }
+        if (header.version != INDEX_VERSION) {
+            error = "unsupported index version " + to_string(header.version);
+            return false;
+        }
+        if (sizeof(header) + uint64_t(header.sectionCount) * sizeof(IndexSection) > size) {
+            error = "truncated section table";
+            return false;
+        }
+        if (header.k < (uint32_t)MIN_K || header.k > (uint32_t)MAX_K) {
+            error = "unsupported k " + to_string(header.k);
+            return false;
+        }
+
+        uint32_t n = header.proteinCount;
+        uint32_t s = header.sequenceCount;
+        database.k = header.k;
+        database.denseWords = bitmapWords(kmerSpace(header.k));
+        database.proteinCount = n;
+        database.sequenceCount = s;
+        uint64_t postingCodesSize = 0;
+        return section(SECTION_HEADER_OFFSETS, uint64_t(n + 1) * sizeof(uint64_t), database.headerOffsets, error)
+            && section(SECTION_HEADER_DATA, database.headerOffsets[n], database.headerData, error)
+            && section(SECTION_SEQUENCE_IDS, uint64_t(n) * sizeof(uint32_t), database.sequenceIds, error)
+            && section(SECTION_COPY_OFFSETS, uint64_t(s + 1) * sizeof(uint64_t), database.copyOffsets, error)
+            && section(SECTION_COPIES, database.copyOffsets[s] * sizeof(uint32_t), database.copies, error)
+            && section(SECTION_LENGTHS, uint64_t(s) * sizeof(uint32_t), database.lengths, error)
+            && section(SECTION_CODE_OFFSETS, uint64_t(s + 1) * sizeof(uint64_t), database.codeOffsets, error)
+            && section(SECTION_CODES, database.codeOffsets[s] * sizeof(uint32_t), database.codes, error)
+            && section(SECTION_DENSE_SLOTS, uint64_t(s) * sizeof(uint32_t), database.denseSlots, error)
+            && section(SECTION_DENSE_BITS, 0, database.denseBits, error)
+            && section(SECTION_POSTING_CODES, 0, database.postingCodes, error, &postingCodesSize)
+            && (database.postingCodeCount = postingCodesSize / sizeof(uint32_t), true)
+            && section(SECTION_POSTING_OFFSETS, (database.postingCodeCount + 1) * sizeof(uint64_t),
+                       database.postingOffsets, error)
+            && section(SECTION_POSTINGS, database.postingOffsets[database.postingCodeCount], database.postings, error)
+            && section(SECTION_SOURCE_PATH, 0, sourcePathData, error, &sourcePathSize)
+            && section(SECTION_SKETCHES, uint64_t(s) * SKETCH_SIZE * sizeof(uint32_t), database.sketches, error)
+            && section(SECTION_RESIDUE_OFFSETS, uint64_t(s + 1) * sizeof(uint64_t), database.residueOffsets, error)
+            && section(SECTION_RESIDUES, database.residueOffsets[s], database.residues, error);
+    }
+
+    const IndexFileHeader& fileHeader() const { return header; }
+
+    string sourcePath() const { return string(sourcePathData, sourcePathSize); }
+
+private:
+    char* base;
+    uint64_t size;
+    IndexFileHeader header;
+    const char* sourcePathData;
+    uint64_t sourcePathSize;
+
+    // Locate a section by tag and check that it holds at least `minimumSize` bytes inside the file;
+    // its actual size goes to `sectionSize` if given
+    template <typename T>
+    bool section(uint32_t tag, uint64_t minimumSize, const T*& pointer, string& error, uint64_t* sectionSize = NULL) {
+        const IndexSection* table = (const IndexSection*)(base + sizeof(IndexFileHeader));
+        for (uint32_t i = 0; i < header.sectionCount; i++) {
+            if (table[i].tag != tag) continue;
+            if (table[i].offset > size || table[i].size > size - table[i].offset || table[i].size < minimumSize) {
+                error = "corrupt section " + to_string(tag);
+                return false;
+            }
+            pointer = (const T*)(base + table[i].offset);
+            if (sectionSize != NULL) *sectionSize = table[i].size;
+            return true;
+        }
+        error = "missing section " + to_string(tag);
+        return false;
+    }
+};
+
+// Read the fixed header of an index file; false if the file does not start with the index magic bytes.
+// Only regular files are read: peeking at a pipe would swallow the start of a FASTA streamed through it.
+bool readIndexHeader(const string& filename, IndexFileHeader& header) {
+    struct stat status;
+    if (stat(filename.c_str(), &status) != 0 || !S_ISREG(status.st_mode)) return false;
+    ifstream file(filename.c_str(), ios::binary);
+    return file.read((char*)&header, sizeof(header)) && memcmp(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0;
+}
+
+// Warn if the FASTA an index was built from has changed since. A different size is a change; a different
+// modification time (or `verify`, which also catches a same-size rewrite within the same second) is
+// settled by checksumming the source again and comparing with the checksum stored in the index.
+void warnIfIndexStale(const MappedIndex& index, bool verify) {
+    struct stat status;
+    string sourcePath = index.sourcePath();
+    if (stat(sourcePath.c_str(), &status) != 0) return;
+    const IndexFileHeader& header = index.fileHeader();
+    bool changed = (uint64_t)status.st_size != header.sourceSize;
+    if (!changed && (verify || (int64_t)status.st_mtime != header.sourceModified)) {
+        SourceInfo current;
+        changed = checksumFile(sourcePath, current) && current.checksum != header.sourceChecksum;
+    }
+    if (changed) {
+        cerr << "Warning: " << sourcePath << " has changed since the index was built; rebuild it with build-index\n";
+    }
+}
+
+// build-index mode: encode a database FASTA once and write it out as an index file
+template <int K>
+int buildIndexMain(const string& databaseFile, const string& indexFile) {
+    vector<FastaPair> database = readFastaDatabase(databaseFile);
+    if (database.empty()) {
+        cerr << "Error: Database is empty or file couldn't be read.\n";
+        return 1;
+    }
+
+    SourceInfo source;
+    if (!checksumFile(databaseFile, source)) {
+        cerr << "Error opening file: " << databaseFile << endl;
+        return 1;
+    }
+
+    DatabaseStorage storage;
+    encodeDatabase<K>(database, storage);
+    database.clear();
+    buildInvertedIndex(storage);
+
+    char resolved[PATH_MAX];
+    string sourcePath = realpath(databaseFile.c_str(), resolved) != NULL ? string(resolved) : databaseFile;
+    if (!writeIndexFile(indexFile, storage, source, sourcePath)) {
+        return 1;
+    }
+
+    cout << "Indexed " << storage.sequenceIds.size() << " proteins (" << storage.lengths.size()
+         << " unique sequences) from " << databaseFile << " into " << indexFile << " (k = " << K << ")\n";
+    cout << "Source checksum (FNV-1a 64): " << hex << setw(16) << setfill('0') << source.checksum << dec << "\n";
+    return 0;
+}
+
+// Command-line settings for a search, an all-vs-all run or a server
+struct SearchOptions {
+    string queryFile;
+    string databaseFile;
+    string queryList;     // --queries: names or regions of the query records to search with
+    bool pairwiseScan;
+    bool batchMode;
+    bool streamMode;
+    size_t prefilterSize; // 0: no sketch prefilter
+    size_t alignCount;    // 0: no alignment re-ranking
+    size_t topCount;      // matches printed per query
+    unsigned threadCount;
+    int k;
+    bool databaseIsIndex; // the database file is an index (checked once, in main)
+    bool verifyIndex;     // --verify: always checksum an index's source FASTA against the stored checksum
+    string outputFile;    // all-vs-all output, or the socket a server listens on
+    double minSimilarity; // lowest similarity reported: the edge list threshold of an all-vs-all run
+    // all-vs-all only
+    bool matrixOutput;    // dense binary matrix instead of an edge list
+};
+
+// Empty top list for one query: deep enough for the printed rows and every alignment candidate,
+// and closed to scores below --min-similarity
+TopList makeTopList(const SearchOptions& options) {
+    return TopList(max(options.topCount, options.alignCount), options.minSimilarity);
+}
+
+// Call f with std::integral_constant<int, k>, so a runtime k selects a compile-time instantiation
+template <typename Function>
+int withK(int k, Function f) {
+    switch (k) {
+        case 2: return f(integral_constant<int, 2>());
+        case 3: return f(integral_constant<int, 3>());
+        case 4: return f(integral_constant<int, 4>());
+        case 5: return f(integral_constant<int, 5>());
+        case 6: return f(integral_constant<int, 6>());
+        case 7: return f(integral_constant<int, 7>());
+    }
+    cerr << "k must be between " << MIN_K << " and " << MAX_K << "\n";
+    return 1;
+}
+
+// Map the database if it is an index file, otherwise read and encode the FASTA into `storage`
+// (with its inverted index if `invertedIndex` is set). Prints the error and returns false on failure.
+template <int K>
+bool loadDatabase(const SearchOptions& options, bool invertedIndex, DatabaseStorage& storage,
+                  MappedIndex& mappedIndex, DatabaseView& database) {
+    const string& databaseFile = options.databaseFile;
+    if (options.databaseIsIndex) {
+        string error;
+        if (!mappedIndex.open(databaseFile, database, error)) {
+            cerr << "Error: cannot use index " << databaseFile << ": " << error << "\n";
+            return false;
+        }
+        warnIfIndexStale(mappedIndex, options.verifyIndex);
+        printDeduplicationStats(database);
+        return true;
+    }
+
+    vector<FastaPair> fastaDatabase = readFastaDatabase(databaseFile);
+    if (fastaDatabase.empty()) {
+        cerr << "Error: Database is empty or file couldn't be read.\n";
+        return false;
+    }
+    encodeDatabase<K>(fastaDatabase, storage);
+    fastaDatabase.clear();
+    if (invertedIndex) {
+        buildInvertedIndex(storage);
+    }
+    database = storage.view();
+    printDeduplicationStats(database);
+    return true;
+}
+
+// Run one search (or batch of searches) with k-mers of length K and print the results
+template <int K>
+int runSearch(const SearchOptions& options) {
+    const string& queryFile = options.queryFile;
+    const string& databaseFile = options.databaseFile;
+    unsigned threadCount = options.threadCount;
+
+    // Read the query file: only the first record, every record in batch mode, or the records listed
+    // with --queries
+    vector<FastaPair> queryRecords = !options.queryList.empty() ? readFastaRegions(queryFile, options.queryList)
+                                     : readFastaDatabase(queryFile, options.batchMode ? SIZE_MAX : 1);
+    
+    if (queryRecords.empty()) {
+        cerr << "Error: Query sequence is empty or file couldn't be read.\n";
+        return 1;
+    }
+    
+    // Keep the top list deep enough to hold every candidate for alignment
+    TopList emptyList = makeTopList(options);
+
+    // Create and populate query k-mer sets
+    vector<KmerSet> queryKmers(queryRecords.size());
+    for (size_t q = 0; q < queryRecords.size(); q++) {
+        populateKmerSet<K>(queryRecords[q].sequence, queryKmers[q]);
+    }
+
+    // Vector to store top proteins, one per query; a streaming search keeps their headers aside
+    vector<TopList> tops;
+    vector<deque<string> > streamedHeaders;
+
+    // Map a prebuilt index, or read and encode the database FASTA now
+    DatabaseStorage storage;
+    MappedIndex mappedIndex;
+    DatabaseView database;
+    if (options.streamMode) {
+        if (options.databaseIsIndex) {
+            cerr << "--stream reads a database FASTA, not an index file\n";
+            return 1;
+        }
+        if (!searchStreaming<K>(databaseFile, queryKmers, threadCount, emptyList, tops, streamedHeaders)) {
+            cerr << "Error: Database is empty or file couldn't be read.\n";
+            return 1;
+        }
+    } else {
+        bool invertedIndex = !options.pairwiseScan && !options.batchMode && options.prefilterSize == 0;
+        if (!loadDatabase<K>(options, invertedIndex, storage, mappedIndex, database)) {
+            return 1;
+        }
+    }
+
+    if (options.streamMode) {
+        // already scored while reading
+    } else if (options.batchMode) {
+        searchBatch(database, queryKmers, threadCount, emptyList, tops);
+    } else {
+        tops.push_back(emptyList);
+        if (options.prefilterSize > 0) {
+            searchWithSketches<K>(database, queryKmers[0], options.prefilterSize, threadCount, tops[0]);
+        } else if (options.pairwiseScan) {
+            searchPairwise<K>(database, queryKmers[0], threadCount, tops[0]);
+        } else {
+            searchInvertedIndex(database, queryKmers[0], threadCount, tops[0]);
+        }
+    }
+
+    // Print results; with --align the best candidates are first aligned, straight from the
+    // residues already in memory
+    cout << "Query file: " << queryFile << endl;
+    cout << "Database file: " << databaseFile << endl << endl;
+    printResults(cout, database, queryRecords, tops, options.alignCount, threadCount, options.batchMode,
+                 options.topCount, K);
+
+    return 0;
+}
+
+// ---------------------------------------------------------------------------------------------
+// All-vs-all similarity
+//
+// Every pair of unique database sequences is scored once. Rows are taken a query tile at a time: a
+// worker indexes QUERY_TILE_SIZE consecutive sequences with buildQueryTile and streams every later
+// sequence past the tile, so only the upper triangle is computed and the tile stays in cache. Each
+// tile's output is written as soon as it is done, so the N^2 result never has to fit in memory.
+// The edge list names proteins, so each sequence pair is written once per pair of headers sharing it.
+//
+// The dense matrix file is a MatrixFileHeader followed by the strict upper triangle as float32,
+// row by row (row i holds columns i+1 .. n-1), so the rows of a tile form one contiguous range that
+// a worker can write in place. Row and column i are the i-th unique sequence; line i of
+// <output>.names holds the headers of the proteins sharing it, tab-separated.
+// ---------------------------------------------------------------------------------------------
+
+const char MATRIX_MAGIC[8] = {'T', 'E', 'T', 'R', 'A', 'M', 'A', 'T'};
+const uint32_t MATRIX_VERSION = 2; // 2: rows are unique sequences
+// Default edge list threshold, above the similarity unrelated proteins reach by chance
+const double DEFAULT_MIN_SIMILARITY = 0.05;
+
+struct MatrixFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrderMark;
+    uint32_t sequenceCount;
+    uint32_t k;
+};
+
+// Position of row i's first entry in the packed strict upper triangle of an n x n matrix
+uint64_t triangleRowOffset(uint64_t n, uint64_t i) {
+    return i * (n - 1) - i * (i - 1) / 2;
+}
+
+// Protein label for the edge list: the header's first word without the '>'
+string proteinLabel(string_view header) {
+    size_t begin = header.compare(0, 1, ">") == 0 ? 1 : 0;
+    size_t end = header.find_first_of(" \t", begin);
+    return string(header.substr(begin, end == string::npos ? string::npos : end - begin));
+}
+
+// Write a whole buffer at a file offset
+bool writeAt(int fd, const void* data, size_t size, uint64_t offset) {
+    const char* bytes = (const char*)data;
+    while (size > 0) {
+        ssize_t written = pwrite(fd, bytes, size, offset);
+        if (written <= 0) return false;
+        bytes += written;
+        size -= written;
+        offset += written;
+    }
+    return true;
+}
+
+// all-vs-all mode: score every pair of database sequences and write an edge list or a dense matrix
+template <int K>
+int allVsAllMain(const SearchOptions& options) {
+    DatabaseStorage storage;
+    MappedIndex mappedIndex;
+    DatabaseView database;
+    if (!loadDatabase<K>(options, false, storage, mappedIndex, database)) {
+        return 1;
+    }
+    const uint32_t n = database.sequenceCount;
+    const string& outputFile = options.outputFile;
+
+    int fd = ::open(outputFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        cerr << "Error opening file: " << outputFile << endl;
+        return 1;
+    }
+    bool ok = true;
+    uint64_t matrixOffset = sizeof(MatrixFileHeader);
+    if (options.matrixOutput) {
+        MatrixFileHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, MATRIX_MAGIC, sizeof(header.magic));
+        header.version = MATRIX_VERSION;
+        header.byteOrderMark = INDEX_BYTE_ORDER_MARK;
+        header.sequenceCount = n;
+        header.k = K;
+        ok = writeAt(fd, &header, sizeof(header), 0)
+            && ftruncate(fd, matrixOffset + triangleRowOffset(n, n) * sizeof(float)) == 0;
+    }
+
+    // Rows and columns are taken in this order. For an edge list it is by set size, so the columns a tile
+    // meets get steadily larger and the scan can stop at the first one too large to reach the threshold;
+    // the dense matrix keeps database order.
+    vector<uint32_t> order(n);
+    for (uint32_t id = 0; id < n; id++) {
+        order[id] = id;
+    }
+    if (!options.matrixOutput) {
+        stable_sort(order.begin(), order.end(),
+                    [&](uint32_t a, uint32_t b) { return database.setSize(a) < database.setSize(b); });
+    }
+
+    // Edge list tiles finish out of order but are written in tile order, so the output is deterministic
+    size_t tileCount = (n + QUERY_TILE_SIZE - 1) / QUERY_TILE_SIZE;
+    vector<string> finishedTiles(tileCount);
+    vector<bool> tileReady(tileCount, false);
+    size_t nextTileToWrite = 0;
+    uint64_t edgeCount = 0;
+    uint64_t writeOffset = 0;
+    mutex outputMutex;
+
+    parallelForChunks(n, QUERY_TILE_SIZE, options.threadCount, [&](unsigned, size_t begin, size_t end) {
+        QueryTile tile = buildQueryTile([&](size_t q) { return database.kmers(order[q]); }, begin, end);
+        vector<uint32_t> intersections;
+        vector<float> rows;
+        vector<pair<pair<uint32_t, uint32_t>, float> > edges;
+        if (options.matrixOutput) {
+            rows.resize(triangleRowOffset(n, end) - triangleRowOffset(n, begin));
+        } else {
+            // Proteins sharing a row's sequence are identical to each other
+            for (size_t i = begin; i < end; i++) {
+                double score = tile.setSizes[i - begin] == 0 ? 0.0 : 1.0;
+                if (score < options.minSimilarity) continue;
+                uint32_t id = order[i];
+                for (const uint32_t* a = database.copiesBegin(id); a < database.copiesEnd(id); a++) {
+                    for (const uint32_t* b = a + 1; b < database.copiesEnd(id); b++) {
+                        edges.push_back(make_pair(make_pair(*a, *b), float(score)));
+                    }
+                }
+            }
+        }
+
+        for (uint32_t j = begin + 1; j < n; j++) {
+            KmerSpan column = database.kmers(order[j]);
+            // Columns only grow from here, so once none of the tile's rows can reach the threshold, none will
+            if (!options.matrixOutput && tileUpperBound(tile, column.size) < options.minSimilarity) break;
+            countTileIntersections(tile, column, intersections);
+            // Only rows above the diagonal
+            for (size_t i = begin; i < end && i < j; i++) {
+                uint32_t intersection = intersections[i - begin];
+                size_t unionCount = tile.setSizes[i - begin] + column.size - intersection;
+                double score = unionCount == 0 ? 0.0 : (double)(intersection) / unionCount;
+                if (options.matrixOutput) {
+                    rows[triangleRowOffset(n, i) - triangleRowOffset(n, begin) + (j - i - 1)] = score;
+                } else if (score >= options.minSimilarity) {
+                    uint32_t rowId = order[i], columnId = order[j];
+                    for (const uint32_t* a = database.copiesBegin(rowId); a < database.copiesEnd(rowId); a++) {
+                        for (const uint32_t* b = database.copiesBegin(columnId); b < database.copiesEnd(columnId); b++) {
+                            edges.push_back(make_pair(make_pair(min(*a, *b), max(*a, *b)), float(score)));
+                        }
+                    }
+                }
+            }
+        }
+
+        if (options.matrixOutput) {
+            uint64_t offset = matrixOffset + triangleRowOffset(n, begin) * sizeof(float);
+            if (!writeAt(fd, rows.data(), rows.size() * sizeof(float), offset)) {
+                lock_guard<mutex> lock(outputMutex);
+                ok = false;
+            }
+            return;
+        }
+
+        sort(edges.begin(), edges.end());
+        ostringstream text;
+        text << fixed << setprecision(7);
+        for (size_t e = 0; e < edges.size(); e++) {
+            text << proteinLabel(database.header(edges[e].first.first)) << "\t"
+                 << proteinLabel(database.header(edges[e].first.second)) << "\t" << edges[e].second << "\n";
+        }
+
+        lock_guard<mutex> lock(outputMutex);
+        edgeCount += edges.size();
+        finishedTiles[begin / QUERY_TILE_SIZE] = text.str();
+        tileReady[begin / QUERY_TILE_SIZE] = true;
+        while (nextTileToWrite < tileCount && tileReady[nextTileToWrite]) {
+            string& out = finishedTiles[nextTileToWrite];
+            ok = ok && writeAt(fd, out.data(), out.size(), writeOffset);
+            writeOffset += out.size();
+            string().swap(out);
+            nextTileToWrite++;
+        }
+    });
+
+    if (::close(fd) != 0) ok = false;
+    if (!ok) {
+        cerr << "Error writing file: " << outputFile << endl;
+        return 1;
+    }
+
+    uint64_t pairCount = uint64_t(n) * (n - 1) / 2;
+    if (options.matrixOutput) {
+        string namesFile = outputFile + ".names";
+        ofstream names(namesFile.c_str());
+        for (uint32_t id = 0; id < n; id++) {
+            for (const uint32_t* copy = database.copiesBegin(id); copy < database.copiesEnd(id); copy++) {
+                names << (copy == database.copiesBegin(id) ? "" : "\t") << database.header(*copy);
+            }
+            names << "\n";
+        }
+        names.close();
+        if (!names) {
+            cerr << "Error writing file: " << namesFile << endl;
+            return 1;
+        }
+        cout << "Scored " << pairCount << " pairs of " << n << " unique sequences (" << database.proteinCount
+             << " proteins); wrote the " << n << " x " << n << " similarity matrix to " << outputFile
+             << " and row names to " << namesFile << "\n";
+    } else {
+        cout << "Scored " << pairCount << " pairs of " << n << " unique sequences (" << database.proteinCount
+             << " proteins); wrote " << edgeCount
+             << " pairs with similarity >= " << options.minSimilarity << " to " << outputFile << "\n";
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------------------------
+// Query server
+//
+// `serve` loads or maps the database once and answers searches over a local Unix-domain socket, so
+// a pipeline issuing many small queries pays the database load only at startup. One thread polls
+// the listening socket and every open connection, reads requests as their bytes arrive, and queues
+// each complete request for a pool of workers; a worker scores it and sends the response, so
+// concurrent clients are served in parallel and an idle client holds no worker. When the queue is
+// full the request is answered "busy" at once rather than stalling the other connections, and a
+// connection that sends nothing for CONNECTION_IDLE_SECONDS is closed.
+//
+// A connection carries any number of requests, each answered before the next is read:
+//   request:  RequestHeader, then `length` bytes of query FASTA text
+//   response: ResponseHeader, then `length` bytes of text
+// The text of a successful response is what a search prints after its "Query file:" line; on
+// failure it is the error message. Integers are in native byte order, as both ends share a machine.
+// ---------------------------------------------------------------------------------------------
+
+const uint32_t REQUEST_BATCH = 1; // search with every record, not only the first
+// Largest query payload a server accepts
+const uint32_t MAX_REQUEST_BYTES = 64u << 20;
+// A connection silent this long (between or within requests) is closed; also the longest a
+// worker waits on a client that does not read its response
+const int CONNECTION_IDLE_SECONDS = 60;
+// Complete requests that may wait for a worker, per worker thread
+const size_t PENDING_REQUESTS_PER_THREAD = 4;
+
+struct RequestHeader {
+    uint32_t length;
+    uint32_t flags;
+};
+
+const uint32_t RESPONSE_RESULTS = 0;
+const uint32_t RESPONSE_ERROR = 1;
+const uint32_t RESPONSE_BUSY = 2; // every worker is occupied and the queue is full; retry later
+
+struct ResponseHeader {
+    uint32_t status; // RESPONSE_*
+    uint32_t length;
+};
+
+// Read exactly `size` bytes; false on error or if the peer closes first
+bool readFully(int fd, void* data, size_t size) {
+    char* bytes = (char*)data;
+    while (size > 0) {
+        ssize_t count = ::read(fd, bytes, size);
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) return false;
+        bytes += count;
+        size -= count;
+    }
+    return true;
+}
+
+// Write a whole buffer to a socket; MSG_NOSIGNAL keeps a vanished peer from raising SIGPIPE
+bool sendFully(int fd, const void* data, size_t size) {
+    const char* bytes = (const char*)data;
+    while (size > 0) {
+        ssize_t count = send(fd, bytes, size, MSG_NOSIGNAL);
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) return false;
+        bytes += count;
+        size -= count;
+    }
+    return true;
+}
+
+bool sendResponse(int fd, uint32_t status, const string& text) {
+    ResponseHeader header = {status, (uint32_t)text.size()};
+    return sendFully(fd, &header, sizeof(header)) && sendFully(fd, text.data(), text.size());
+}
+
+// Fill a Unix socket address; false if the path does not fit
+bool socketAddress(const string& path, sockaddr_un& address) {
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) return false;
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+// Search one request's queries against the served database, single-threaded. Returns false with
+// the message in `text` if the request has no usable query.
+template <int K>
+bool answerRequest(const DatabaseView& database, const SearchOptions& options, const string& payload,
+                   bool batchMode, string& text) {
+    FastaReader reader;
+    reader.attach(payload.data(), payload.size());
+    vector<FastaPair> queryRecords;
+    FastaRecord record;
+    while (reader.next(record)) {
+        if (record.sequence.empty()) continue;
+        queryRecords.push_back(FastaPair());
+        queryRecords.back().header.assign(record.header);
+        queryRecords.back().sequence.assign(record.sequence);
+        if (!batchMode) break;
+    }
+    if (queryRecords.empty()) {
+        text = "Query sequence is empty\n";
+        return false;
+    }
+
+    vector<TopList> tops(queryRecords.size(), makeTopList(options));
+    KmerSet queryKmers;
+    for (size_t q = 0; q < queryRecords.size(); q++) {
+        populateKmerSet<K>(queryRecords[q].sequence, queryKmers);
+        searchInvertedIndex(database, queryKmers, 1, tops[q]);
+    }
+
+    ostringstream out;
+    out << "Database file: " << options.databaseFile << "\n\n";
+    printResults(out, database, queryRecords, tops, options.alignCount, 1, batchMode, options.topCount, K);
+    text = out.str();
+    return true;
+}
+
+// A complete request read by the polling thread, waiting for a worker
+struct ServeRequest {
+    int fd;
+    uint32_t flags;
+    string payload;
+};
+
+// Sent by a worker through a pipe once it has answered the request on `fd`
+struct ServeDone {
+    int fd;
+    int keepOpen; // 0 if the response could not be sent
+};
+
+// What the polling thread knows of one client connection
+struct ServeConnection {
+    RequestHeader header;
+    size_t headerBytes = 0;  // bytes of `header` received so far
+    string payload;
+    size_t payloadBytes = 0; // bytes of `payload` received so far
+    bool busy = false;       // a request is with a worker; not read again until it is answered
+    chrono::steady_clock::time_point lastActive;
+};
+
+// Take in what has arrived on a connection that poll reported readable. Returns false if the
+// connection should be closed; sets `complete` once a whole request is buffered.
+bool readRequestBytes(int fd, ServeConnection& connection, bool& complete) {
+    complete = false;
+    bool inHeader = connection.headerBytes < sizeof(RequestHeader);
+    char* target = inHeader ? (char*)&connection.header + connection.headerBytes
+                            : &connection.payload[0] + connection.payloadBytes;
+    size_t wanted = inHeader ? sizeof(RequestHeader) - connection.headerBytes
+                             : connection.payload.size() - connection.payloadBytes;
+    ssize_t count = ::read(fd, target, wanted);
+    if (count < 0 && (errno == EINTR || errno == EAGAIN)) return true;
+    if (count <= 0) return false;
+
+    if (!inHeader) {
+        connection.payloadBytes += count;
+    } else {
+        connection.headerBytes += count;
+        if (connection.headerBytes < sizeof(RequestHeader)) return true;
+        if (connection.header.length > MAX_REQUEST_BYTES) {
+            sendResponse(fd, RESPONSE_ERROR, "Request too large\n");
+            return false;
+        }
+        connection.payload.resize(connection.header.length);
+        connection.payloadBytes = 0;
+    }
+    complete = connection.payloadBytes == connection.payload.size();
+    return true;
+}
+
+// Path of the listening socket, removed again when the server is stopped by a signal
+char serverSocketPath[sizeof(sockaddr_un().sun_path)];
+
+void stopServer(int) {
+    unlink(serverSocketPath);
+    _exit(0);
+}
+
+// serve mode: load the database once, then answer queries on a Unix socket until interrupted
+template <int K>
+int serveMain(const SearchOptions& options) {
+    const string& socketPath = options.outputFile;
+    sockaddr_un address;
+    if (!socketAddress(socketPath, address)) {
+        cerr << "Error: socket path is too long: " << socketPath << "\n";
+        return 1;
+    }
+
+    // A socket file left by a server that is no longer running is replaced; a live one is not
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (probe >= 0 && connect(probe, (const sockaddr*)&address, sizeof(address)) == 0) {
+        ::close(probe);
+        cerr << "Error: a server is already listening on " << socketPath << "\n";
+        return 1;
+    }
+    if (probe >= 0) ::close(probe);
+    struct stat status;
+    if (stat(socketPath.c_str(), &status) == 0 && S_ISSOCK(status.st_mode)) {
+        unlink(socketPath.c_str());
+    }
+
+    DatabaseStorage storage;
+    MappedIndex mappedIndex;
+    DatabaseView database;
+    if (!loadDatabase<K>(options, true, storage, mappedIndex, database)) {
+        return 1;
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 || ::bind(listener, (const sockaddr*)&address, sizeof(address)) != 0
+        || listen(listener, SOMAXCONN) != 0) {
+        cerr << "Error: cannot listen on " << socketPath << ": " << strerror(errno) << "\n";
+        return 1;
+    }
+    memcpy(serverSocketPath, address.sun_path, sizeof(serverSocketPath));
+    signal(SIGINT, stopServer);
+    signal(SIGTERM, stopServer);
+
+    int wake[2];
+    if (pipe(wake) != 0) {
+        cerr << "Error: cannot create a pipe: " << strerror(errno) << "\n";
+        return 1;
+    }
+
+    BoundedQueue<ServeRequest> requests(options.threadCount * PENDING_REQUESTS_PER_THREAD);
+    vector<thread> workers;
+    for (unsigned t = 0; t < options.threadCount; t++) {
+        workers.push_back(thread([&] {
+            ServeRequest request;
+            string text;
+            while (requests.pop(request)) {
+                bool ok = answerRequest<K>(database, options, request.payload, (request.flags & REQUEST_BATCH) != 0, text);
+                bool sent = sendResponse(request.fd, ok ? RESPONSE_RESULTS : RESPONSE_ERROR, text);
+                // Writes this small are atomic, so all workers can share the pipe
+                ServeDone done = {request.fd, sent ? 1 : 0};
+                while (::write(wake[1], &done, sizeof(done)) < 0 && errno == EINTR) {}
+            }
+        }));
+    }
+
+    cout << "Serving " << options.databaseFile << " (k = " << K << ") on " << socketPath << " with "
+         << options.threadCount << " workers" << endl;
+    unordered_map<int, ServeConnection> connections;
+    vector<pollfd> polled;
+    const chrono::seconds idleLimit(CONNECTION_IDLE_SECONDS);
+    auto closeConnection = [&](int fd) {
+        ::close(fd);
+        connections.erase(fd);
+    };
+    while (true) {
+        // Connections with a request at a worker are left out until the worker reports back
+        polled.clear();
+        polled.push_back(pollfd{listener, POLLIN, 0});
+        polled.push_back(pollfd{wake[0], POLLIN, 0});
+        for (const auto& entry : connections) {
+            if (!entry.second.busy) polled.push_back(pollfd{entry.first, POLLIN, 0});
+        }
+        if (poll(polled.data(), polled.size(), 1000) < 0) {
+            if (errno == EINTR) continue;
+            cerr << "Error: poll failed: " << strerror(errno) << "\n";
+            break;
+        }
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+
+        if (polled[1].revents & POLLIN) {
+            ServeDone done[64];
+            ssize_t count = ::read(wake[0], done, sizeof(done));
+            for (ssize_t d = 0; d < count / (ssize_t)sizeof(ServeDone); d++) {
+                if (!done[d].keepOpen) {
+                    closeConnection(done[d].fd);
+                    continue;
+                }
+                ServeConnection& connection = connections[done[d].fd];
+                connection.busy = false;
+                connection.lastActive = now;
+            }
+        }
+
+        if (polled[0].revents & POLLIN) {
+            int fd = accept(listener, NULL, NULL);
+            if (fd >= 0) {
+                // A worker gives up on a client that stops reading its response
+                timeval timeout = {CONNECTION_IDLE_SECONDS, 0};
+                setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+                connections[fd].lastActive = now;
+            } else if (errno != EINTR && errno != ECONNABORTED) {
+                cerr << "Error: accept failed: " << strerror(errno) << "\n";
+                break;
+            }
+        }
+
+        for (size_t p = 2; p < polled.size(); p++) {
+            if (polled[p].revents == 0) continue;
+            int fd = polled[p].fd;
+            ServeConnection& connection = connections[fd];
+            bool complete;
+            if (!readRequestBytes(fd, connection, complete)) {
+                closeConnection(fd);
+                continue;
+            }
+            connection.lastActive = now;
+            if (!complete) continue;
+
+            ServeRequest request = {fd, connection.header.flags, std::move(connection.payload)};
+            connection.payload.clear();
+            connection.headerBytes = 0;
+            connection.payloadBytes = 0;
+            connection.busy = true;
+            if (!requests.tryPush(request)) {
+                connection.busy = false;
+                if (!sendResponse(fd, RESPONSE_BUSY, "Server is busy; try again later\n")) closeConnection(fd);
+            }
+        }
+
+        for (auto entry = connections.begin(); entry != connections.end();) {
+            if (!entry->second.busy && now - entry->second.lastActive > idleLimit) {
+                ::close(entry->first);
+                entry = connections.erase(entry);
+            } else {
+                ++entry;
+            }
+        }
+    }
+
+    requests.close();
+    for (size_t t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+    for (const auto& entry : connections) {
+        ::close(entry.first);
+    }
+    ::close(wake[0]);
+    ::close(wake[1]);
+    ::close(listener);
+    unlink(socketPath.c_str());
+    return 1;
+}
+
+// client mode: send a query file to a running server and print its answer like a local search
+int clientMain(const string& socketPath, const string& queryFile, bool batchMode) {
+    InputFile file(queryFile);
+    if (!file.is_open()) {
+        cerr << "Error opening file: " << queryFile << endl;
+        return 1;
+    }
+    ostringstream contents;
+    contents << file.rdbuf();
+    if (file.failed()) {
+        return 1;
+    }
+    string payload = contents.str();
+    if (payload.size() > MAX_REQUEST_BYTES) {
+        cerr << "Error: query file is larger than the server accepts\n";
+        return 1;
+    }
+
+    sockaddr_un address;
+    if (!socketAddress(socketPath, address)) {
+        cerr << "Error: socket path is too long: " << socketPath << "\n";
+        return 1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (const sockaddr*)&address, sizeof(address)) != 0) {
+        cerr << "Error: cannot connect to " << socketPath << ": " << strerror(errno) << "\n";
+        if (fd >= 0) ::close(fd);
+        return 1;
+    }
+
+    RequestHeader request = {(uint32_t)payload.size(), batchMode ? REQUEST_BATCH : 0};
+    ResponseHeader response;
+    string text;
+    bool ok = sendFully(fd, &request, sizeof(request)) && sendFully(fd, payload.data(), payload.size())
+        && readFully(fd, &response, sizeof(response));
+    if (ok) {
+        text.resize(response.length);
+        ok = readFully(fd, &text[0], text.size());
+    }
+    ::close(fd);
+    if (!ok) {
+        cerr << "Error: connection to " << socketPath << " failed\n";
+        return 1;
+    }
+    if (response.status != RESPONSE_RESULTS) {
+        cerr << "Error: " << text;
+        return 1;
+    }
+
+    cout << "Query file: " << queryFile << endl;
+    cout << text;
+    return 0;
+}
+
+// Main function
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        cout << "Usage: " << argv[0] << " <query_FASTA_file> <database_FASTA_or_index_file> [options]\n";
+        cout << "       " << argv[0] << " build-index <database_FASTA_file> <index_file> [--k <n>]\n";
+        cout << "       " << argv[0] << " all-vs-all <database_FASTA_or_index_file> <output_file> [options]\n";
+        cout << "       " << argv[0] << " serve <database_FASTA_or_index_file> <socket_path> [--k <n>] [--threads <n>]"
+             << " [--top <n>] [--min-similarity <x>] [--align <n>]\n";
+        cout << "       " << argv[0] << " client <socket_path> <query_FASTA_file> [--batch]\n";
+        cout << "Options:\n";
+        cout << "  --k <n>         peptide length, " << MIN_K << " to " << MAX_K << " (default: " << DEFAULT_K
+             << ", or the index's own)\n";
+        cout << "  --scan          score each database protein pairwise instead of through the inverted index\n";
+        cout << "  --threads <n>   worker threads (default: all hardware threads)\n";
+        cout << "  --batch         search with every record of the query file, reporting matches per query\n";
+        cout << "  --queries <file> search with the query records named in the file, one name or name:start-end\n"
+             << "                  region per line, read through the query FASTA's .fai index (implies --batch)\n";
+        cout << "  --stream        stream the database FASTA through bounded memory instead of loading it\n";
+        cout << "  --prefilter <n> shortlist the n best MinHash sketch estimates, then score only those exactly\n";
+        cout << "  --top <n>       print the n best matches per query (default: " << DEFAULT_TOP_COUNT << ")\n";
+        cout << "  --min-similarity <x> report only matches scoring at least x (default: 0; all-vs-all: "
+             << DEFAULT_MIN_SIMILARITY << ")\n";
+        cout << "  --align <n>     re-rank the n best matches by Smith-Waterman score (BLOSUM62, affine gaps)\n";
+        cout << "  --verify        checksum an index's source FASTA to check that the index is still current\n";
+        cout << "all-vs-all options:\n";
+        cout << "  --matrix        write every pair as a dense binary float32 matrix instead of an edge list\n";
+        return 0;
+    }
+
+    // Initialize ASCII array for amino acid conversion
+    initializeASCII();
+
+    string command = argv[1];
+    bool buildIndex = command == "build-index";
+    bool allVsAll = command == "all-vs-all";
+    bool serve = command == "serve";
+    if ((buildIndex || allVsAll || serve) && argc < 4) {
+        cerr << "Usage: " << argv[0] << " " << command << " <database_FASTA_file> <output_file> [options]\n";
+        return 1;
+    }
+
+    // The client needs no database, only the query and the server's socket
+    if (command == "client") {
+        if (argc < 4) {
+            cerr << "Usage: " << argv[0] << " client <socket_path> <query_FASTA_file> [--batch]\n";
+            return 1;
+        }
+        bool batchMode = false;
+        for (int i = 4; i < argc; i++) {
+            if (string(argv[i]) == "--batch") {
+                batchMode = true;
+            } else {
+                cerr << "Unknown option: " << argv[i] << "\n";
+                return 1;
+            }
+        }
+        return clientMain(argv[2], argv[3], batchMode);
+    }
+
+    SearchOptions options;
+    options.queryFile = argv[1];
+    options.databaseFile = argv[2];
+    options.pairwiseScan = false;
+    options.batchMode = false;
+    options.streamMode = false;
+    options.prefilterSize = 0;
+    options.alignCount = 0;
+    options.topCount = DEFAULT_TOP_COUNT;
+    options.threadCount = max(1u, thread::hardware_concurrency());
+    options.k = 0; // 0: not given
+    options.databaseIsIndex = false;
+    options.verifyIndex = false;
+    options.outputFile = (buildIndex || allVsAll || serve) ? argv[3] : "";
+    options.matrixOutput = false;
+    options.minSimilarity = allVsAll ? DEFAULT_MIN_SIMILARITY : 0;
+    for (int i = (buildIndex || allVsAll || serve) ? 4 : 3; i < argc; i++) {
+        string option = argv[i];
+        if (option == "--k" && i + 1 < argc) {
+            int value;
+            try {
+                value = stoi(argv[++i]);
+            } catch (...) {
+                value = 0;
+            }
+            if (value < MIN_K || value > MAX_K) {
+                cerr << "k must be an integer between " << MIN_K << " and " << MAX_K << "\n";
+                return 1;
+            }
+            options.k = value;
+        } else if (option == "--threads" && i + 1 < argc && !buildIndex) {
+            int value;
+            try {
+                value = stoi(argv[++i]);
+            } catch (...) {
+                value = 0;
+            }
+            if (value <= 0) {
+                cerr << "Number of threads must be a positive integer\n";
+                return 1;
+            }
+            options.threadCount = value;
+        } else if (allVsAll && option == "--matrix") {
+            options.matrixOutput = true;
+        } else if (!buildIndex && option == "--min-similarity" && i + 1 < argc) {
+            double value;
+            try {
+                value = stod(argv[++i]);
+            } catch (...) {
+                value = -1;
+            }
+            if (!(value >= 0 && value <= 1)) {
+                cerr << "Minimum similarity must be a number between 0 and 1\n";
+                return 1;
+            }
+            options.minSimilarity = value;
+        } else if (!buildIndex && option == "--verify") {
+            options.verifyIndex = true;
+        } else if (buildIndex || allVsAll) {
+            cerr << "Unknown option: " << option << "\n";
+            return 1;
+        } else if (option == "--scan") {
+            options.pairwiseScan = true;
+        } else if (option == "--batch") {
+            options.batchMode = true;
+        } else if (option == "--queries" && i + 1 < argc) {
+            options.queryList = argv[++i];
+            options.batchMode = true;
+        } else if (option == "--stream") {
+            options.streamMode = true;
+        } else if (option == "--prefilter" && i + 1 < argc) {
+            int value;
+            try {
+                value = stoi(argv[++i]);
+            } catch (...) {
+                value = 0;
+            }
+            if (value <= 0) {
+                cerr << "Prefilter shortlist size must be a positive integer\n";
+                return 1;
+            }
+            options.prefilterSize = value;
+        } else if (option == "--top" && i + 1 < argc) {
+            int value;
+            try {
+                value = stoi(argv[++i]);
+            } catch (...) {
+                value = 0;
+            }
+            if (value <= 0) {
+                cerr << "Number of matches to print must be a positive integer\n";
+                return 1;
+            }
+            options.topCount = value;
+        } else if (option == "--align" && i + 1 < argc) {
+            int value;
+            try {
+                value = stoi(argv[++i]);
+            } catch (...) {
+                value = 0;
+            }
+            if (value <= 0) {
+                cerr << "Number of matches to align must be a positive integer\n";
+                return 1;
+            }
+            options.alignCount = value;
+        } else {
+            cerr << "Unknown option: " << option << "\n";
+            return 1;
+        }
+    }
+
+    if (buildIndex) {
+        return withK(options.k != 0 ? options.k : DEFAULT_K, [&](auto kTag) {
+            return buildIndexMain<decltype(kTag)::value>(options.databaseFile, options.outputFile);
+        });
+    }
+
+    if (options.pairwiseScan && (options.batchMode || options.streamMode)) {
+        cerr << "--scan cannot be combined with --batch, --queries or --stream\n";
+        return 1;
+    }
+    if (options.prefilterSize > 0 && (options.pairwiseScan || options.batchMode || options.streamMode)) {
+        cerr << "--prefilter cannot be combined with --scan, --batch, --queries or --stream\n";
+        return 1;
+    }
+    if (serve && (options.pairwiseScan || options.batchMode || options.streamMode || options.prefilterSize > 0)) {
+        cerr << "serve takes only --k, --threads, --top, --min-similarity and --align; clients choose --batch per request\n";
+        return 1;
+    }
+    if (options.alignCount > 0 && options.streamMode) {
+        cerr << "--align needs the database residues in memory and cannot be combined with --stream\n";
+        return 1;
+    }
+
+    // An index fixes k: take it from the file, and refuse a different --k
+    IndexFileHeader indexHeader;
+    options.databaseIsIndex = readIndexHeader(options.databaseFile, indexHeader);
+    if (options.databaseIsIndex) {
+        if (options.k != 0 && (uint32_t)options.k != indexHeader.k) {
+            cerr << "Error: " << options.databaseFile << " was built with k = " << indexHeader.k
+                 << ", not " << options.k << "\n";
+            return 1;
+        }
+        options.k = indexHeader.k;
+    } else if (options.k == 0) {
+        options.k = DEFAULT_K;
+    }
+
+    if (allVsAll) {
+        return withK(options.k, [&](auto kTag) { return allVsAllMain<decltype(kTag)::value>(options); });
+    }
+    if (serve) {
+        return withK(options.k, [&](auto kTag) { return serveMain<decltype(kTag)::value>(options); });
+    }
+    return withK(options.k, [&](auto kTag) { return runSearch<decltype(kTag)::value>(options); });
+}
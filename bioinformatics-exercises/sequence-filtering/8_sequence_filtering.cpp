@@ -10,11 +10,12 @@ reports both the correlation coefficient and the p-value
  */ 
 
 #include <iostream>
-#include <fstream>
+#include <sstream>
 #include <string>
 #include <vector>
 #include <random>
 #include <cmath>
+#include "../common/gzip_input.h"
 
 using namespace std;
 
@@ -104,18 +105,25 @@ int main(int argc, char **argv) {
         return 1;
     }
     
-    // Open input file
-    ifstream InFile(argv[1]);
-    if (!InFile.is_open()) {
+    // Open input file; a gzip file is decompressed as it is read
+    InputFile File(argv[1]);
+    if (!File.is_open()) {
         cerr << "Cannot open file \"" << argv[1] << "\"\n";
         return 1;
     }
     
+    // Read the whole file once, since a compressed file cannot be rewound
+    stringstream Contents;
+    Contents << File.rdbuf();
+    if (File.failed()) {
+        return 1;  // damaged gzip data, already reported
+    }
+    string Text = Contents.str();
+    
     // Count number of lines
     int rows = 0;
-    char Z;
-    while (InFile.get(Z)) {
-        if (Z == '\n') ++rows;
+    for (size_t i = 0; i < Text.size(); ++i) {
+        if (Text[i] == '\n') ++rows;
     }
     --rows; // Adjust for the last line if needed
     cout << "Number of rows in the file: " << rows << "\n";
@@ -124,9 +132,8 @@ int main(int argc, char **argv) {
     random_device rd;
     mt19937 gen(rd());
     
-    // Return to the start of the file
-    InFile.clear();
-    InFile.seekg(0, InFile.beg);
+    // Parse the data from the start of the file
+    istringstream InFile(Text);
     
     // Use vectors instead of fixed arrays for flexibility
     vector<double> X(rows), Y(rows);
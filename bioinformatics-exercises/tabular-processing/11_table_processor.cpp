@@ -11,6 +11,7 @@ coefficients between pairs of samples.
 #include <vector>
 #include <string>
 #include <cmath>
+#include "../common/gzip_input.h"
 
 using namespace std;
 
@@ -20,7 +21,8 @@ int main(int argc, char **argv) {
         return 1;
     }
     
-    ifstream inFile(argv[1]);
+    // A gzip file is decompressed as it is read
+    InputFile inFile(argv[1]);
     if (!inFile.is_open()) {
         cout << "Cannot open file \"" << argv[1] << "\"\n";
         return 1;
@@ -74,6 +76,10 @@ int main(int argc, char **argv) {
         
         data.push_back(row);
     }
+    // A damaged gzip file ends early (with a message on stderr); write no table from part of it
+    if (inFile.failed()) {
+        return 1;
+    }
     inFile.close();
     
     int N = sampleNames.size();